@@ -19,27 +19,91 @@
 
 namespace manifold {
 
+/** @ingroup Private */
+/**
+ * How a Collider stores its hierarchy. BINARY keeps only the radix tree, which
+ * suits GPUs. WIDE adds a 4-wide BVH for the querries, which is faster on CPUs.
+ * COMPACT keeps only the wide BVH and the leaf boxes, in over a third less
+ * memory than WIDE, but rebuilds the binary tree to refit the boxes and for the
+ * dual-tree traversal. The default on the host backends is WIDE, or COMPACT if
+ * built with MANIFOLD_COMPACT_BVH.
+ */
+enum class BVHLayout { BINARY, WIDE, COMPACT };
+
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+constexpr BVHLayout kDefaultBVHLayout = BVHLayout::BINARY;
+#elif defined(MANIFOLD_COMPACT_BVH)
+constexpr BVHLayout kDefaultBVHLayout = BVHLayout::COMPACT;
+#else
+constexpr BVHLayout kDefaultBVHLayout = BVHLayout::WIDE;
+#endif
+
+/** @ingroup Private */
+/**
+ * A node of the 4-wide BVH of the WIDE and COMPACT layouts, collapsed from
+ * every other level of the binary one. Its children's bounds are quantized to
+ * 8 bits per side within a grid given by origin and scale, and stored by axis,
+ * so all four can be tested at once with SIMD, and a node fits in 64 bytes.
+ */
+struct WideNode {
+  float origin[3];
+  float scale[3];
+  uint8_t min[3][4];
+  uint8_t max[3][4];
+  // A wide node index if non-negative, otherwise ~leaf, or kNoChild if empty.
+  // Children 2i and 2i + 1 are those of the binary node's child i, or child 2i
+  // is that child itself if it is a leaf, so the binary tree can be recovered.
+  int child[4];
+};
+
 /** @ingroup Private */
 class Collider {
  public:
   Collider() {}
-  Collider(const VecDH<Box>& leafBB, const VecDH<uint32_t>& leafMorton);
-  // Aborts and returns false if transform is not axis aligned.
+  template <typename Code>
+  // Large trees are optimized unless optimize is false, which is for testing.
+  Collider(const VecDH<Box>& leafBB, const VecDH<Code>& leafMorton,
+           bool optimize = true, BVHLayout layout = kDefaultBVHLayout);
+  // Aborts and returns false if transform is singular.
   bool Transform(glm::mat4x3);
   void UpdateBoxes(const VecDH<Box>& leafBB);
   // Collisions returns a sparse result, where i is the querry index and j is
-  // the leaf index where their bounding boxes overlap.
+  // the leaf index where their bounding boxes overlap. It is sorted by (i, j).
   template <typename T>
   SparseIndices Collisions(const VecDH<T>& querriesIn) const;
+  // As above, but with the leaves of another collider as the querries.
+  SparseIndices Collisions(const Collider& other) const;
+  float SAHCost() const;
 
  private:
+  BVHLayout layout_ = kDefaultBVHLayout;
+  // The binary tree, which is empty in the COMPACT layout.
   VecDH<Box> nodeBBox_;
-  VecDH<int> nodeParent_;
   // even nodes are leaves, odd nodes are internal, root is 1
   VecDH<thrust::pair<int, int>> internalChildren_;
+  // Maps querries into the frame the boxes were computed in, accumulating the
+  // inverses of the transforms that were not applied to the boxes directly.
+  glm::mat4x3 queryTransform_ = glm::mat4x3(1.0f);
+  // Empty in the BINARY layout.
+  VecDH<WideNode> wideNode_;
+  // The internal index of each wide node's binary node, kept by the WIDE
+  // layout to requantize the wide nodes after the binary tree is refit.
+  VecDH<int> wideInternal_;
+  // Only kept by the COMPACT layout, where nodeBBox_ is empty.
+  VecDH<Box> leafBBox_;
+  int numLeaves_ = 0;
 
-  int NumInternal() const { return internalChildren_.size(); };
-  int NumLeaves() const { return NumInternal() + 1; };
+  int NumInternal() const { return glm::max(numLeaves_ - 1, 0); };
+  int NumLeaves() const { return numLeaves_; };
+  // A single leaf is its own root.
+  int Root() const { return NumInternal() > 0 ? 1 : 0; }
+  template <typename T>
+  SparseIndices FindAll(const VecDH<T>& querriesIn) const;
+  void BuildWideNodes();
+  void RefitWideNodes();
+  void ExpandWideNodes(VecDH<Box>& nodeBBox,
+                       VecDH<thrust::pair<int, int>>& internalChildren,
+                       VecDH<int>& wideInternal) const;
 };
 
 }  // namespace manifold
\ No newline at end of file
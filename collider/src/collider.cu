@@ -12,12 +12,35 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <thrust/scan.h>
+#include <thrust/transform_scan.h>
+#include <thrust/transform_reduce.h>
+
+#include <cstring>
+
 #include "collider.cuh"
 #include "utils.cuh"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Adjustable parameters
 constexpr int kInitialLength = 128;
 constexpr int kLengthMultiple = 4;
+// Node pairs are expanded breadth-first until there are this many, so that the
+// dual-tree traversal has enough independent work to go parallel.
+constexpr int kMinSeeds = 1 << 14;
+constexpr int kMaxSeedRounds = 24;
+// Colliders with at least this many leaves have their treelets optimized, as
+// the tree quality then matters more than the extra build time.
+constexpr int kOptimizeMinLeaves = 1 << 10;
+constexpr int kTreeletLeaves = 7;
+constexpr int kTreeletRounds = 3;
+// Relative padding of the quantization grid of the wide nodes, which is well
+// above the float rounding error of dequantizing it.
+constexpr float kQuantizeSlack = 1e-5;
+constexpr int kNoChild = 1 << 31;
 // Fundamental constants
 constexpr int kRoot = 1;
 
@@ -31,10 +54,106 @@ __host__ __device__ int Internal2Node(int internal) { return internal * 2 + 1; }
 __host__ __device__ int Node2Leaf(int node) { return node / 2; }
 __host__ __device__ int Leaf2Node(int leaf) { return leaf * 2; }
 
+// A line, used for a vertical point querry once it has been mapped into a
+// collider's frame, where it may no longer be vertical.
+struct Line {
+  glm::vec3 origin;
+  glm::vec3 direction;
+};
+
+// Rounding in the transforms between frames can move a querry by a few ulps
+// relative to the boxes it is tested against, so those tests are padded by
+// this much relative to the coordinates involved.
+__host__ __device__ glm::vec3 Padding(glm::vec3 center, glm::vec3 halfSize) {
+  return kTolerance * (glm::abs(center) + halfSize);
+}
+
+// Returns a padded axis-aligned box containing the given box after an
+// arbitrary affine transform.
+__host__ __device__ Box Rebox(const Box& box, const glm::mat4x3& transform) {
+  const glm::vec3 center = transform * glm::vec4(box.Center(), 1.0f);
+  const glm::mat3 absLinear(glm::abs(transform[0]), glm::abs(transform[1]),
+                            glm::abs(transform[2]));
+  glm::vec3 halfSize = absLinear * (0.5f * box.Size());
+  halfSize += Padding(center, halfSize);
+  return Box(center - halfSize, center + halfSize);
+}
+
+__host__ __device__ bool Overlaps(const Box& box, const Box& querry) {
+  return box.DoesOverlap(querry);
+}
+
+__host__ __device__ bool Overlaps(const Box& box, glm::vec3 querry) {
+  return box.DoesOverlap(querry);
+}
+
+// Slab test of the line against the padded box.
+__host__ __device__ bool Overlaps(const Box& box, const Line& querry) {
+  const glm::vec3 pad = Padding(box.Center(), 0.5f * box.Size());
+  const glm::vec3 min = box.min - pad;
+  const glm::vec3 max = box.max + pad;
+  float tMin = -1.0f / 0.0f;
+  float tMax = 1.0f / 0.0f;
+  for (int i : {0, 1, 2}) {
+    const float origin = querry.origin[i];
+    const float direction = querry.direction[i];
+    if (direction == 0.0f) {
+      if (origin < min[i] || origin > max[i]) return false;
+    } else {
+      float t0 = (min[i] - origin) / direction;
+      float t1 = (max[i] - origin) / direction;
+      if (t0 > t1) thrust::swap(t0, t1);
+      tMin = glm::max(tMin, t0);
+      tMax = glm::min(tMax, t1);
+    }
+  }
+  return tMin <= tMax;
+}
+
+// Half the surface area, which is all the SAH needs.
+__host__ __device__ float HalfArea(const Box& box) {
+  const glm::vec3 size = box.Size();
+  return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+struct ReboxQuerry {
+  const glm::mat4x3 transform;
+
+  __host__ __device__ void operator()(Box& box) {
+    box = Rebox(box, transform);
+  }
+};
+
+struct PointToLine {
+  const glm::mat4x3 transform;
+
+  __host__ __device__ void operator()(thrust::tuple<Line&, glm::vec3> in) {
+    Line& line = thrust::get<0>(in);
+    line.origin = transform * glm::vec4(thrust::get<1>(in), 1.0f);
+    line.direction = transform[2];
+  }
+};
+
+VecDH<Box> ToFrame(const VecDH<Box>& querries, const glm::mat4x3& transform) {
+  VecDH<Box> out(querries);
+  thrust::for_each(out.beginD(), out.endD(), ReboxQuerry({transform}));
+  return out;
+}
+
+// The vertical line through each point.
+VecDH<Line> ToFrame(const VecDH<glm::vec3>& querries,
+                    const glm::mat4x3& transform) {
+  VecDH<Line> out(querries.size());
+  thrust::for_each_n(zip(out.beginD(), querries.cbeginD()), querries.size(),
+                     PointToLine({transform}));
+  return out;
+}
+
+template <typename Code>
 struct CreateRadixTree {
   int* nodeParent_;
   thrust::pair<int, int>* internalChildren_;
-  const VecD<uint32_t> leafMorton_;
+  const VecD<Code> leafMorton_;
 
   __host__ __device__ int PrefixLength(uint32_t a, uint32_t b) const {
 // count-leading-zeros is used to find the number of identical highest-order
@@ -46,6 +165,14 @@ struct CreateRadixTree {
 #endif
   }
 
+  __host__ __device__ int PrefixLength(uint64_t a, uint64_t b) const {
+#ifdef __CUDA_ARCH__
+    return __clzll(a ^ b);
+#else
+    return __builtin_clzll(a ^ b);
+#endif
+  }
+
   __host__ __device__ int PrefixLength(int i, int j) const {
     if (j < 0 || j >= leafMorton_.size()) {
       return -1;
@@ -53,7 +180,7 @@ struct CreateRadixTree {
       int out;
       if (leafMorton_[i] == leafMorton_[j])
         // use index to disambiguate
-        out = 32 +
+        out = 8 * sizeof(Code) +
               PrefixLength(static_cast<uint32_t>(i), static_cast<uint32_t>(j));
       else
         out = PrefixLength(leafMorton_[i], leafMorton_[j]);
@@ -115,57 +242,599 @@ struct CreateRadixTree {
   }
 };
 
+// Bottom-up pass like BuildInternalBoxes, run after the boxes are built. Each
+// internal node, once both of its subtrees are done, roots a treelet, grown by
+// repeatedly expanding its largest node into that node's children. The treelet
+// is then rebuilt as the binary tree over the same leaves in the same order
+// with the least total surface area (SAH cost), found by dynamic programming
+// over contiguous ranges. Keeping the leaf order keeps the querry results
+// sorted by leaf, and only keeping subtrees that are no taller than before
+// keeps the depth bound of the radix tree.
+struct OptimizeTreelets {
+  Box* nodeBBox_;
+  int* counter_;
+  int* nodeHeight_;
+  int* nodeParent_;
+  thrust::pair<int, int>* internalChildren_;
+
+  __host__ __device__ void operator()(int leaf) {
+    int node = Leaf2Node(leaf);
+    do {
+      node = nodeParent_[node];
+      int internal = Node2Internal(node);
+      if (AtomicAdd(counter_[internal], 1) == 0) return;
+      Restructure(node);
+    } while (node != kRoot);
+  }
+
+  __host__ __device__ void Restructure(int root) {
+    // Form the treelet, with its leaves in order.
+    const thrust::pair<int, int> children =
+        internalChildren_[Node2Internal(root)];
+    int leaves[kTreeletLeaves] = {children.first, children.second};
+    int internals[kTreeletLeaves - 1] = {root};
+    int numLeaves = 2;
+    float oldCost = HalfArea(nodeBBox_[root]);
+    const int oldHeight = 1 + glm::max(nodeHeight_[children.first],
+                                       nodeHeight_[children.second]);
+    while (numLeaves < kTreeletLeaves) {
+      int expand = -1;
+      float maxArea = -1;
+      for (int i = 0; i < numLeaves; ++i) {
+        if (IsLeaf(leaves[i])) continue;
+        const float area = HalfArea(nodeBBox_[leaves[i]]);
+        if (area > maxArea) {
+          maxArea = area;
+          expand = i;
+        }
+      }
+      if (expand < 0) break;
+      const int node = leaves[expand];
+      internals[numLeaves - 1] = node;
+      oldCost += maxArea;
+      for (int i = numLeaves; i > expand + 1; --i) leaves[i] = leaves[i - 1];
+      leaves[expand] = internalChildren_[Node2Internal(node)].first;
+      leaves[expand + 1] = internalChildren_[Node2Internal(node)].second;
+      ++numLeaves;
+    }
+
+    // Find the best tree over each range of leaves [i, j].
+    Box box[kTreeletLeaves][kTreeletLeaves];
+    float cost[kTreeletLeaves][kTreeletLeaves];
+    int height[kTreeletLeaves][kTreeletLeaves];
+    int split[kTreeletLeaves][kTreeletLeaves];
+    for (int i = 0; i < numLeaves; ++i) {
+      box[i][i] = nodeBBox_[leaves[i]];
+      cost[i][i] = 0;
+      height[i][i] = nodeHeight_[leaves[i]];
+    }
+    for (int length = 2; length <= numLeaves; ++length) {
+      for (int i = 0; i + length <= numLeaves; ++i) {
+        const int j = i + length - 1;
+        box[i][j] = box[i][j - 1].Union(box[j][j]);
+        split[i][j] = i;
+        for (int k = i + 1; k < j; ++k) {
+          if (cost[i][k] + cost[k + 1][j] <
+              cost[i][split[i][j]] + cost[split[i][j] + 1][j])
+            split[i][j] = k;
+        }
+        const int k = split[i][j];
+        cost[i][j] = HalfArea(box[i][j]) + cost[i][k] + cost[k + 1][j];
+        height[i][j] = 1 + glm::max(height[i][k], height[k + 1][j]);
+      }
+    }
+
+    const int last = numLeaves - 1;
+    if (!(cost[0][last] < oldCost) || height[0][last] > oldHeight) {
+      nodeHeight_[root] = oldHeight;
+      return;
+    }
+
+    // Rebuild the treelet, reusing its internal nodes.
+    int stack[kTreeletLeaves - 1][3];
+    int top = 0;
+    stack[0][0] = 0;
+    stack[0][1] = last;
+    stack[0][2] = root;
+    int nextInternal = 1;
+    while (top >= 0) {
+      const int i = stack[top][0];
+      const int j = stack[top][1];
+      const int node = stack[top--][2];
+      const int k = split[i][j];
+      int child[2];
+      const int range[2][2] = {{i, k}, {k + 1, j}};
+      for (int c : {0, 1}) {
+        const int first = range[c][0];
+        const int second = range[c][1];
+        if (first == second) {
+          child[c] = leaves[first];
+        } else {
+          child[c] = internals[nextInternal++];
+          ++top;
+          stack[top][0] = first;
+          stack[top][1] = second;
+          stack[top][2] = child[c];
+        }
+        nodeParent_[child[c]] = node;
+      }
+      internalChildren_[Node2Internal(node)] =
+          thrust::make_pair(child[0], child[1]);
+      nodeBBox_[node] = box[i][j];
+      nodeHeight_[node] = height[i][j];
+    }
+  }
+};
+
+struct InternalArea {
+  const Box* nodeBBox_;
+
+  __host__ __device__ float operator()(int internal) {
+    return HalfArea(nodeBBox_[Internal2Node(internal)]);
+  }
+};
+
+// Fills the four slots of a wide node with the binary nodes that become its
+// children: slots 2i and 2i + 1 get the children of its binary node's child i,
+// or slot 2i gets that child itself if it is a leaf, and slot 2i + 1 gets -1.
+__host__ __device__ void WideChildren(
+    int children[4], int node,
+    const thrust::pair<int, int>* internalChildren) {
+  const thrust::pair<int, int> pair = internalChildren[Node2Internal(node)];
+  const int binary[2] = {pair.first, pair.second};
+  for (int i : {0, 1}) {
+    if (IsLeaf(binary[i])) {
+      children[2 * i] = binary[i];
+      children[2 * i + 1] = -1;
+    } else {
+      const thrust::pair<int, int> grandchildren =
+          internalChildren[Node2Internal(binary[i])];
+      children[2 * i] = grandchildren.first;
+      children[2 * i + 1] = grandchildren.second;
+    }
+  }
+}
+
+__host__ __device__ Box ChildBox(const WideNode& node, int i) {
+  Box box;
+  for (int axis : {0, 1, 2}) {
+    box.min[axis] = node.origin[axis] + node.scale[axis] * node.min[axis][i];
+    box.max[axis] = node.origin[axis] + node.scale[axis] * node.max[axis][i];
+  }
+  return box;
+}
+
+// Returns a bitmask of the children of the wide node that overlap the querry.
 template <typename T>
+__host__ __device__ int OverlapMask(const WideNode& node, const T& querry) {
+  int mask = 0;
+  for (int i : {0, 1, 2, 3}) {
+    if (node.child[i] != kNoChild && Overlaps(ChildBox(node, i), querry))
+      mask |= 1 << i;
+  }
+  return mask;
+}
+
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+// Lanes of the children that exist.
+__m128 ValidChildren(const WideNode& node) {
+  const __m128i child =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(node.child));
+  const __m128i empty = _mm_cmpeq_epi32(child, _mm_set1_epi32(kNoChild));
+  return _mm_castsi128_ps(_mm_xor_si128(empty, _mm_set1_epi32(-1)));
+}
+
+// Dequantizes the four children's bounds on one axis.
+__m128 Dequantize(const WideNode& node, const uint8_t quantized[4], int axis) {
+  int packed;
+  memcpy(&packed, quantized, 4);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i wide = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+  wide = _mm_unpacklo_epi16(wide, zero);
+  return _mm_add_ps(_mm_set1_ps(node.origin[axis]),
+                    _mm_mul_ps(_mm_set1_ps(node.scale[axis]),
+                               _mm_cvtepi32_ps(wide)));
+}
+#endif
+
+__host__ __device__ int OverlapMask(const WideNode& node, const Box& querry) {
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+  __m128 overlap = ValidChildren(node);
+  for (int axis : {0, 1, 2}) {
+    const __m128 min = Dequantize(node, node.min[axis], axis);
+    const __m128 max = Dequantize(node, node.max[axis], axis);
+    overlap = _mm_and_ps(
+        overlap, _mm_cmple_ps(min, _mm_set1_ps(querry.max[axis])));
+    overlap = _mm_and_ps(
+        overlap, _mm_cmpge_ps(max, _mm_set1_ps(querry.min[axis])));
+  }
+  return _mm_movemask_ps(overlap);
+#else
+  return OverlapMask<Box>(node, querry);
+#endif
+}
+
+// Projected in z, like Box::DoesOverlap(glm::vec3).
+__host__ __device__ int OverlapMask(const WideNode& node,
+                                    const glm::vec3& querry) {
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+  __m128 overlap = ValidChildren(node);
+  for (int axis : {0, 1}) {
+    const __m128 min = Dequantize(node, node.min[axis], axis);
+    const __m128 max = Dequantize(node, node.max[axis], axis);
+    const __m128 value = _mm_set1_ps(querry[axis]);
+    overlap = _mm_and_ps(overlap, _mm_cmple_ps(min, value));
+    overlap = _mm_and_ps(overlap, _mm_cmpge_ps(max, value));
+  }
+  return _mm_movemask_ps(overlap);
+#else
+  return OverlapMask<glm::vec3>(node, querry);
+#endif
+}
+
+// Records the parent of each node, which is only needed while building or
+// refitting, so it is not kept.
+struct FindParents {
+  int* nodeParent_;
+  const thrust::pair<int, int>* internalChildren_;
+
+  __host__ __device__ void operator()(int internal) {
+    nodeParent_[internalChildren_[internal].first] = Internal2Node(internal);
+    nodeParent_[internalChildren_[internal].second] = Internal2Node(internal);
+  }
+};
+
+// Marks the wide nodes of the frontier, which are the binary internal nodes at
+// even depth, and replaces them with the next level of them: their internal
+// grandchildren, or children where the grandchildren are leaves. Run twice
+// like ExpandSeeds: to count and then to fill.
+template <bool countOnly>
+struct ExpandWideFrontier {
+  int* frontierOut_;
+  int* frontierOffset_;
+  int* isWide_;
+  const thrust::pair<int, int>* internalChildren_;
+
+  __host__ __device__ void operator()(thrust::tuple<int, int> in) {
+    const int node = thrust::get<0>(in);
+    const int frontierIdx = thrust::get<1>(in);
+    int children[4];
+    WideChildren(children, node, internalChildren_);
+    int pos = countOnly ? 0 : frontierOffset_[frontierIdx];
+    for (int i = 0; i < 4; ++i) {
+      if (children[i] < 0 || IsLeaf(children[i])) continue;
+      if (!countOnly) frontierOut_[pos] = children[i];
+      ++pos;
+    }
+    if (countOnly) {
+      isWide_[Node2Internal(node)] = 1;
+      frontierOffset_[frontierIdx] = pos;
+    }
+  }
+};
+
+struct CreateWideNodes {
+  WideNode* wideNode_;
+  int* wideInternal_;
+  const int* isWide_;
+  const int* wideIndex_;
+  const thrust::pair<int, int>* internalChildren_;
+
+  __host__ __device__ void operator()(int internal) {
+    if (!isWide_[internal]) return;
+    const int wideIdx = wideIndex_[internal];
+    WideNode& wide = wideNode_[wideIdx];
+    wideInternal_[wideIdx] = internal;
+    int children[4];
+    WideChildren(children, Internal2Node(internal), internalChildren_);
+    for (int i = 0; i < 4; ++i) {
+      const int child = children[i];
+      if (child < 0) {
+        wide.child[i] = kNoChild;
+      } else {
+        wide.child[i] = IsLeaf(child) ? ~Node2Leaf(child)
+                                      : wideIndex_[Node2Internal(child)];
+      }
+    }
+  }
+};
+
+// Quantizes the children's boxes to 8 bits within their binary node's box,
+// rounding outward. The grid is padded by more than the rounding error of its
+// dequantization, so the dequantized boxes always contain the true ones.
+struct RefitWideNode {
+  const Box* nodeBBox_;
+  // The internal index of each wide node's binary node.
+  const int* wideInternal_;
+
+  __host__ __device__ uint8_t Clamp(float cell) {
+    if (!(cell >= 0)) return 0;
+    if (!(cell <= 255)) return 255;
+    return static_cast<uint8_t>(cell);
+  }
+
+  __host__ __device__ const Box& BinaryBox(int child) {
+    return child < 0 ? nodeBBox_[Leaf2Node(~child)]
+                     : nodeBBox_[Internal2Node(wideInternal_[child])];
+  }
+
+  __host__ __device__ void operator()(thrust::tuple<WideNode&, int> inout) {
+    WideNode& wide = thrust::get<0>(inout);
+    const Box& parent = nodeBBox_[Internal2Node(thrust::get<1>(inout))];
+    for (int axis : {0, 1, 2}) {
+      const float slack =
+          kQuantizeSlack *
+          glm::max(glm::abs(parent.min[axis]), glm::abs(parent.max[axis]));
+      const float origin = parent.min[axis] - slack;
+      const float scale = (parent.max[axis] + slack - origin) / 255;
+      wide.origin[axis] = origin;
+      wide.scale[axis] = scale;
+      for (int i = 0; i < 4; ++i) {
+        const bool empty = wide.child[i] == kNoChild;
+        if (empty || !(scale > 0)) {
+          wide.min[axis][i] = 0;
+          wide.max[axis][i] = empty ? 0 : 255;
+          continue;
+        }
+        const Box& box = BinaryBox(wide.child[i]);
+        wide.min[axis][i] =
+            Clamp(glm::floor((box.min[axis] - slack - origin) / scale));
+        wide.max[axis][i] =
+            Clamp(glm::ceil((box.max[axis] + slack - origin) / scale));
+      }
+    }
+  }
+};
+
+// The number of binary internal nodes a wide node was collapsed from.
+struct NumBinary {
+  __host__ __device__ int operator()(const WideNode& wide) {
+    return 1 + (wide.child[1] != kNoChild) + (wide.child[3] != kNoChild);
+  }
+};
+
+// Recovers the binary nodes a wide node was collapsed from, numbering them
+// from its binary node's internal index.
+struct ExpandWideNode {
+  int* nodeParent_;
+  thrust::pair<int, int>* internalChildren_;
+  const int* wideInternal_;
+
+  __host__ __device__ int BinaryNode(int child) {
+    return child < 0 ? Leaf2Node(~child)
+                     : Internal2Node(wideInternal_[child]);
+  }
+
+  __host__ __device__ void Link(int node, int child1, int child2) {
+    internalChildren_[Node2Internal(node)] = thrust::make_pair(child1, child2);
+    nodeParent_[child1] = node;
+    nodeParent_[child2] = node;
+  }
+
+  __host__ __device__ void operator()(thrust::tuple<WideNode, int> in) {
+    const WideNode& wide = thrust::get<0>(in);
+    int internal = thrust::get<1>(in);
+    const int node = Internal2Node(internal);
+    int binary[2];
+    for (int i : {0, 1}) {
+      const int first = BinaryNode(wide.child[2 * i]);
+      if (wide.child[2 * i + 1] == kNoChild) {
+        binary[i] = first;
+      } else {
+        binary[i] = Internal2Node(++internal);
+        Link(binary[i], first, BinaryNode(wide.child[2 * i + 1]));
+      }
+    }
+    Link(node, binary[0], binary[1]);
+  }
+};
+
+// Run twice: first with countOnly to find the number of overlaps of each
+// query, then again to write them out starting at each query's offset, sorted
+// by leaf.
+template <typename T, bool countOnly>
 struct FindCollisions {
   thrust::pair<int*, int*> querryTri_;
-  int* numOverlaps_;
-  const int maxOverlaps_;
+  int* queryOffset_;
   const Box* nodeBBox_;
   const thrust::pair<int, int>* internalChildren_;
+  const bool wide_;
+  const WideNode* wideNode_;
+  // Leaf i's box is leafBBox_[leafStride_ * i], so this may be nodeBBox_.
+  const Box* leafBBox_;
+  const int leafStride_;
 
-  __host__ __device__ int RecordCollision(int node,
-                                          const thrust::tuple<T, int>& query) {
+  __host__ __device__ void operator()(thrust::tuple<T, int> query) {
     const T& queryObj = thrust::get<0>(query);
     const int queryIdx = thrust::get<1>(query);
+    int pos = countOnly ? 0 : queryOffset_[queryIdx];
+    if (wide_) {
+      SearchWide(queryObj, queryIdx, pos);
+    } else {
+      Search(queryObj, queryIdx, pos);
+    }
+    if (countOnly) queryOffset_[queryIdx] = pos;
+  }
 
-    bool overlaps = nodeBBox_[node].DoesOverlap(queryObj);
-    if (overlaps && IsLeaf(node)) {
-      int pos = AtomicAdd(*numOverlaps_, 1);
-      if (pos >= maxOverlaps_)
-        return -1;  // Didn't allocate enough memory; bail out
+  __host__ __device__ void Record(int queryIdx, int leaf, int& pos) {
+    if (!countOnly) {
       querryTri_.first[pos] = queryIdx;
-      querryTri_.second[pos] = Node2Leaf(node);
+      querryTri_.second[pos] = leaf;
     }
-    return overlaps && IsInternal(node);  // Should traverse into node
+    ++pos;
   }
 
-  __host__ __device__ void operator()(thrust::tuple<T, int> query) {
-    // stack cannot overflow because radix tree has max depth 30 (Morton code) +
+  __host__ __device__ void Search(const T& queryObj, int queryIdx, int& pos) {
+    // stack cannot overflow because radix tree has max depth 63 (Morton code) +
     // 32 (index).
-    int stack[64];
+    int stack[96];
     int top = -1;
-    // Depth-first search
+    // Depth-first search, visiting the first child before the second, so that
+    // the leaves are found in increasing order.
     int node = kRoot;
     while (1) {
-      int internal = Node2Internal(node);
-      int child1 = internalChildren_[internal].first;
-      int child2 = internalChildren_[internal].second;
+      if (IsLeaf(node)) {
+        Record(queryIdx, Node2Leaf(node), pos);
+      } else {
+        int internal = Node2Internal(node);
+        int child1 = internalChildren_[internal].first;
+        int child2 = internalChildren_[internal].second;
+
+        bool traverse1 = Overlaps(nodeBBox_[child1], queryObj);
+        bool traverse2 = Overlaps(nodeBBox_[child2], queryObj);
+
+        if (traverse1 || traverse2) {
+          node = traverse1 ? child1 : child2;  // go here next
+          if (traverse1 && traverse2) {
+            stack[++top] = child2;  // save the other for later
+          }
+          continue;
+        }
+      }
+      if (top < 0) break;   // done
+      node = stack[top--];  // get a saved node
+    }
+  }
+
+  __host__ __device__ void SearchWide(const T& queryObj, int queryIdx,
+                                      int& pos) {
+    // Each wide level leaves at most three children on the stack, and there
+    // are at most half as many levels as in the binary tree.
+    int stack[160];
+    int top = 0;
+    // A single leaf has no wide nodes.
+    stack[0] = wideNode_ != nullptr ? 0 : ~0;
+    while (top >= 0) {
+      const int entry = stack[top--];
+      if (entry < 0) {
+        // The quantized bounds are conservative, so test the exact box.
+        if (Overlaps(leafBBox_[leafStride_ * ~entry], queryObj))
+          Record(queryIdx, ~entry, pos);
+        continue;
+      }
+      const WideNode& node = wideNode_[entry];
+      const int mask = OverlapMask(node, queryObj);
+      // Pushed in reverse, so the leaves are still found in increasing order.
+      for (int i = 3; i >= 0; --i) {
+        if (mask & (1 << i)) stack[++top] = node.child[i];
+      }
+    }
+  }
+};
+
+// A pair of nodes, the first from this collider and the second from the other,
+// whose bounding boxes overlap.
+typedef thrust::pair<int, int> NodePair;
+
+struct DualTree {
+  const Box* nodeBBox_;
+  const thrust::pair<int, int>* internalChildren_;
+  const Box* otherBBox_;
+  const thrust::pair<int, int>* otherChildren_;
+  // Maps the other collider's frame into this one's, if they differ.
+  const glm::mat4x3 otherToThis_;
+  const bool transformed_;
+
+  __host__ __device__ Box OtherBox(const Box& box) const {
+    return transformed_ ? Rebox(box, otherToThis_) : box;
+  }
+
+  __host__ __device__ bool Overlaps(NodePair pair) const {
+    return nodeBBox_[pair.first].DoesOverlap(OtherBox(otherBBox_[pair.second]));
+  }
+
+  // Splits whichever node of the pair is internal, or the larger of the two,
+  // so both trees are descended together. Returns the number of child pairs
+  // that overlap, which are written to child1 first.
+  __host__ __device__ int Split(NodePair pair, NodePair& child1,
+                                NodePair& child2) const {
+    const Box& box = nodeBBox_[pair.first];
+    const Box& other = otherBBox_[pair.second];
+    const glm::vec3 size = box.Size();
+    const glm::vec3 otherSize = other.Size();
+    const bool splitThis =
+        !IsLeaf(pair.first) &&
+        (IsLeaf(pair.second) || size.x + size.y + size.z >=
+                                    otherSize.x + otherSize.y + otherSize.z);
+    if (splitThis) {
+      const thrust::pair<int, int> children =
+          internalChildren_[Node2Internal(pair.first)];
+      child1 = thrust::make_pair(children.first, pair.second);
+      child2 = thrust::make_pair(children.second, pair.second);
+    } else {
+      const thrust::pair<int, int> children =
+          otherChildren_[Node2Internal(pair.second)];
+      child1 = thrust::make_pair(pair.first, children.first);
+      child2 = thrust::make_pair(pair.first, children.second);
+    }
+    const bool overlap1 = Overlaps(child1);
+    const bool overlap2 = Overlaps(child2);
+    if (!overlap1) child1 = child2;
+    return overlap1 + overlap2;
+  }
+};
+
+// Replaces each seed pair with its overlapping child pairs, leaving leaf pairs
+// as they are. Run twice like FindCollisions: to count and then to fill.
+template <bool countOnly>
+struct ExpandSeeds {
+  NodePair* seedOut_;
+  int* seedOffset_;
+  const DualTree tree_;
+
+  __host__ __device__ void operator()(thrust::tuple<NodePair, int> in) {
+    const NodePair seed = thrust::get<0>(in);
+    const int seedIdx = thrust::get<1>(in);
+    NodePair child[2] = {seed, seed};
+    const int numChild = IsLeaf(seed.first) && IsLeaf(seed.second)
+                             ? 1
+                             : tree_.Split(seed, child[0], child[1]);
+    if (countOnly) {
+      seedOffset_[seedIdx] = numChild;
+    } else {
+      for (int i = 0; i < numChild; ++i) {
+        seedOut_[seedOffset_[seedIdx] + i] = child[i];
+      }
+    }
+  }
+};
 
-      int traverse1 = RecordCollision(child1, query);
-      if (traverse1 < 0) return;
-      int traverse2 = RecordCollision(child2, query);
-      if (traverse2 < 0) return;
+// Depth-first search of all overlapping leaf pairs below each seed, recording
+// the other collider's leaf in the first column.
+template <bool countOnly>
+struct FindDualCollisions {
+  thrust::pair<int*, int*> otherThisLeaf_;
+  int* seedOffset_;
+  const DualTree tree_;
 
-      if (!traverse1 && !traverse2) {
-        if (top < 0) break;   // done
-        node = stack[top--];  // get a saved node
+  __host__ __device__ void operator()(thrust::tuple<NodePair, int> in) {
+    const int seedIdx = thrust::get<1>(in);
+    int pos = countOnly ? 0 : seedOffset_[seedIdx];
+    // Each level of descent splits one of the two trees and saves at most one
+    // pair, so the stack holds at most the sum of their depths.
+    NodePair stack[192];
+    int top = -1;
+    NodePair pair = thrust::get<0>(in);
+    while (1) {
+      if (IsLeaf(pair.first) && IsLeaf(pair.second)) {
+        if (!countOnly) {
+          otherThisLeaf_.first[pos] = Node2Leaf(pair.second);
+          otherThisLeaf_.second[pos] = Node2Leaf(pair.first);
+        }
+        ++pos;
       } else {
-        node = traverse1 ? child1 : child2;  // go here next
-        if (traverse1 && traverse2) {
-          stack[++top] = child2;  // save the other for later
+        NodePair child1, child2;
+        const int numChild = tree_.Split(pair, child1, child2);
+        if (numChild > 0) {
+          pair = child1;
+          if (numChild == 2) stack[++top] = child2;
+          continue;
         }
       }
+      if (top < 0) break;
+      pair = stack[top--];
     }
+    if (countOnly) seedOffset_[seedIdx] = pos;
   }
 };
 
@@ -193,62 +862,298 @@ struct TransformBox {
     box = box.Transform(transform);
   }
 };
+
+// Copies in the leaf boxes of a binary tree and builds its internal ones.
+void BuildBoxes(VecDH<Box>& nodeBBox, const VecDH<Box>& leafBB,
+                const VecDH<int>& nodeParent,
+                const VecDH<thrust::pair<int, int>>& internalChildren) {
+  strided_range<VecDH<Box>::IterD> leaves(nodeBBox.beginD(), nodeBBox.endD(),
+                                          2);
+  thrust::copy(leafBB.cbeginD(), leafBB.cendD(), leaves.begin());
+  if (internalChildren.size() == 0) return;
+  VecDH<int> counter(internalChildren.size(), 0);
+  thrust::for_each_n(
+      countAt(0), leafBB.size(),
+      BuildInternalBoxes({nodeBBox.ptrD(), counter.ptrD(), nodeParent.cptrD(),
+                          internalChildren.cptrD()}));
+}
+
+// Quantizes the wide nodes from the binary tree they were collapsed from.
+void QuantizeWideNodes(VecDH<WideNode>& wideNode, const VecDH<Box>& nodeBBox,
+                       const VecDH<int>& wideInternal) {
+  thrust::for_each_n(zip(wideNode.beginD(), wideInternal.cbeginD()),
+                     wideNode.size(),
+                     RefitWideNode({nodeBBox.cptrD(), wideInternal.cptrD()}));
+}
+
+float BinarySAHCost(const VecDH<Box>& nodeBBox) {
+  const int numInternal = nodeBBox.size() / 2;
+  if (numInternal == 0) return 0;
+  const float total = thrust::transform_reduce(
+      poolPolicy(), countAt(0), countAt(numInternal),
+      InternalArea({nodeBBox.cptrD()}), 0.0f, thrust::plus<float>());
+  const Box root = nodeBBox.cbeginD()[kRoot];
+  return total / HalfArea(root);
+}
 }  // namespace
 
 namespace manifold {
 
 /**
  * Creates a Bounding Volume Hierarchy (BVH) from an input set of axis-aligned
- * bounding boxes and corresponding Morton codes. It is assumed these vectors
- * are already sorted by increasing Morton code.
+ * bounding boxes and corresponding Morton codes, which may be 32 or 64-bit. It
+ * is assumed these vectors are already sorted by increasing Morton code.
  */
-Collider::Collider(const VecDH<Box>& leafBB,
-                   const VecDH<uint32_t>& leafMorton) {
+template <typename Code>
+Collider::Collider(const VecDH<Box>& leafBB, const VecDH<Code>& leafMorton,
+                   bool optimize, BVHLayout layout)
+    : layout_(layout) {
   ALWAYS_ASSERT(leafBB.size() == leafMorton.size(), userErr,
                 "vectors must be the same length");
+  numLeaves_ = leafBB.size();
   int num_nodes = 2 * leafBB.size() - 1;
   // assign and allocate members
   nodeBBox_.resize(num_nodes);
-  nodeParent_.resize(num_nodes, -1);
+  VecDH<int> nodeParent(num_nodes, -1);
   internalChildren_.resize(leafBB.size() - 1, thrust::make_pair(-1, -1));
   // organize tree
   thrust::for_each_n(countAt(0), NumInternal(),
-                     CreateRadixTree({nodeParent_.ptrD(),
-                                      internalChildren_.ptrD(), leafMorton}));
-  UpdateBoxes(leafBB);
+                     CreateRadixTree<Code>({nodeParent.ptrD(),
+                                            internalChildren_.ptrD(),
+                                            leafMorton}));
+  BuildBoxes(nodeBBox_, leafBB, nodeParent, internalChildren_);
+  if (optimize && NumLeaves() >= kOptimizeMinLeaves) {
+    VecDH<int> counter(NumInternal());
+    VecDH<int> nodeHeight(num_nodes, 0);
+    for (int round = 0; round < kTreeletRounds; ++round) {
+      thrust::fill(counter.beginD(), counter.endD(), 0);
+      thrust::for_each_n(
+          countAt(0), NumLeaves(),
+          OptimizeTreelets({nodeBBox_.ptrD(), counter.ptrD(),
+                            nodeHeight.ptrD(), nodeParent.ptrD(),
+                            internalChildren_.ptrD()}));
+    }
+  }
+  if (layout_ != BVHLayout::BINARY) BuildWideNodes();
+}
+
+/**
+ * Collapses every other level of the binary tree into the wide BVH, keeping
+ * the leaves in order. There is about one wide node per two leaves, so the
+ * WIDE layout takes 90 bytes per leaf in all. The COMPACT layout then drops the
+ * binary tree, keeping only the wide nodes and leaf boxes, which take 56 bytes
+ * per leaf, the same as the binary tree alone.
+ */
+void Collider::BuildWideNodes() {
+  if (NumInternal() > 0) {
+    // Found level by level from the root, which is O(n) in total.
+    VecDH<int> isWide(NumInternal() + 1, 0);
+    VecDH<int> frontier(1, kRoot);
+    VecDH<int> frontierOffset;
+    while (frontier.size() > 0) {
+      frontierOffset.resize(frontier.size() + 1, 0);
+      thrust::for_each_n(
+          zip(frontier.cbeginD(), countAt(0)), frontier.size(),
+          ExpandWideFrontier<true>({nullptr, frontierOffset.ptrD(),
+                                    isWide.ptrD(), internalChildren_.ptrD()}));
+      thrust::exclusive_scan(poolPolicy(), frontierOffset.beginD(),
+                             frontierOffset.endD(), frontierOffset.beginD());
+      VecDH<int> newFrontier(frontierOffset.H().back());
+      thrust::for_each_n(
+          zip(frontier.cbeginD(), countAt(0)), frontier.size(),
+          ExpandWideFrontier<false>({newFrontier.ptrD(), frontierOffset.ptrD(),
+                                     isWide.ptrD(), internalChildren_.ptrD()}));
+      frontier = std::move(newFrontier);
+    }
+    VecDH<int> wideIndex(NumInternal() + 1);
+    thrust::exclusive_scan(poolPolicy(), isWide.beginD(), isWide.endD(),
+                           wideIndex.beginD());
+    wideNode_.resize(wideIndex.H().back());
+    wideInternal_.resize(wideNode_.size());
+    thrust::for_each_n(countAt(0), NumInternal(),
+                       CreateWideNodes({wideNode_.ptrD(), wideInternal_.ptrD(),
+                                        isWide.cptrD(), wideIndex.cptrD(),
+                                        internalChildren_.ptrD()}));
+    QuantizeWideNodes(wideNode_, nodeBBox_, wideInternal_);
+  }
+  if (layout_ != BVHLayout::COMPACT) return;
+  wideInternal_.resize(0);
+  leafBBox_.resize(NumLeaves());
+  strided_range<VecDH<Box>::IterD> leaves(nodeBBox_.beginD(), nodeBBox_.endD(),
+                                          2);
+  thrust::copy(leaves.begin(), leaves.end(), leafBBox_.beginD());
+  nodeBBox_.resize(0);
+  internalChildren_.resize(0);
+}
+
+/**
+ * Rebuilds the binary tree of the COMPACT layout from the wide BVH and the leaf
+ * boxes, along with the internal index of each wide node's binary node. The
+ * internal nodes are renumbered, but the tree is otherwise the same.
+ */
+void Collider::ExpandWideNodes(VecDH<Box>& nodeBBox,
+                               VecDH<thrust::pair<int, int>>& internalChildren,
+                               VecDH<int>& wideInternal) const {
+  nodeBBox.resize(glm::max(2 * NumLeaves() - 1, 0));
+  internalChildren.resize(NumInternal());
+  VecDH<int> nodeParent(nodeBBox.size(), -1);
+  wideInternal.resize(wideNode_.size());
+  thrust::transform_exclusive_scan(poolPolicy(), wideNode_.cbeginD(),
+                                   wideNode_.cendD(), wideInternal.beginD(),
+                                   NumBinary(), 0, thrust::plus<int>());
+  thrust::for_each_n(zip(wideNode_.cbeginD(), wideInternal.cbeginD()),
+                     wideNode_.size(),
+                     ExpandWideNode({nodeParent.ptrD(), internalChildren.ptrD(),
+                                     wideInternal.cptrD()}));
+  BuildBoxes(nodeBBox, leafBBox_, nodeParent, internalChildren);
+}
+
+/**
+ * Requantizes the wide BVH, if any, after its boxes have changed. In the WIDE
+ * layout these are the refit binary tree's, and in the COMPACT layout only the
+ * leaves', so the binary tree is rebuilt temporarily.
+ */
+void Collider::RefitWideNodes() {
+  if (layout_ == BVHLayout::BINARY) return;
+  if (layout_ == BVHLayout::WIDE) {
+    QuantizeWideNodes(wideNode_, nodeBBox_, wideInternal_);
+    return;
+  }
+  VecDH<Box> nodeBBox;
+  VecDH<thrust::pair<int, int>> internalChildren;
+  VecDH<int> wideInternal;
+  ExpandWideNodes(nodeBBox, internalChildren, wideInternal);
+  QuantizeWideNodes(wideNode_, nodeBBox, wideInternal);
+}
+
+/**
+ * Returns the SAH cost of the hierarchy: the total surface area of its internal
+ * nodes relative to that of the root. This is roughly the number of internal
+ * nodes a small querry visits, so lower is better. Long, thin or unevenly
+ * tessellated parts with many overlapping siblings score high.
+ */
+float Collider::SAHCost() const {
+  if (NumInternal() == 0) return 0;
+  if (layout_ != BVHLayout::COMPACT) return BinarySAHCost(nodeBBox_);
+  VecDH<Box> nodeBBox;
+  VecDH<thrust::pair<int, int>> internalChildren;
+  VecDH<int> wideInternal;
+  ExpandWideNodes(nodeBBox, internalChildren, wideInternal);
+  return BinarySAHCost(nodeBBox);
 }
 
 /**
  * For a vector of querry objects, this returns a sparse array of overlaps
  * between the querries and the bounding boxes of the collider. Querries are
  * normally axis-aligned bounding boxes. Points can also be used, and this case
- * overlaps are defined as lying in the XY projection of the bounding box.
+ * overlaps are defined as lying in the XY projection of the bounding box. If
+ * the collider has been given a transform that its boxes could not absorb, the
+ * querries are mapped into the frame of its boxes instead: boxes are re-boxed
+ * conservatively, and points become the lines they project along.
  */
 template <typename T>
 SparseIndices Collider::Collisions(const VecDH<T>& querriesIn) const {
-  int maxOverlaps = 1 << 20;
-  SparseIndices querryTri(maxOverlaps);
-  int nOverlaps = 0;
-  while (1) {
-    // scalar number of overlaps found
-    VecDH<int> nOverlapsD(1, 0);
-    // calculate Bounding Box overlaps
+  if (queryTransform_ == glm::mat4x3(1.0f)) return FindAll(querriesIn);
+  return FindAll(ToFrame(querriesIn, queryTransform_));
+}
+
+template <typename T>
+SparseIndices Collider::FindAll(const VecDH<T>& querriesIn) const {
+  const int numQuery = querriesIn.size();
+  if (NumLeaves() == 0) return SparseIndices();
+  // Count the overlaps of each query, then scan the counts into offsets, so the
+  // output is exactly sized, sorted by query then leaf, and needs no atomics.
+  VecDH<int> queryOffset(numQuery + 1, 0);
+  const thrust::pair<int*, int*> noOutput(nullptr, nullptr);
+  const bool wide = layout_ != BVHLayout::BINARY;
+  const WideNode* wideNodes = wideNode_.size() > 0 ? wideNode_.ptrD() : nullptr;
+  const bool compact = layout_ == BVHLayout::COMPACT;
+  const Box* leafBBox = compact ? leafBBox_.ptrD() : nodeBBox_.ptrD();
+  const int leafStride = compact ? 1 : 2;
+  thrust::for_each_n(
+      zip(querriesIn.cbeginD(), countAt(0)), numQuery,
+      FindCollisions<T, true>({noOutput, queryOffset.ptrD(), nodeBBox_.ptrD(),
+                               internalChildren_.ptrD(), wide, wideNodes,
+                               leafBBox, leafStride}));
+  thrust::exclusive_scan(poolPolicy(), queryOffset.beginD(),
+                         queryOffset.endD(), queryOffset.beginD());
+
+  SparseIndices querryTri(queryOffset.H().back());
+  thrust::for_each_n(
+      zip(querriesIn.cbeginD(), countAt(0)), numQuery,
+      FindCollisions<T, false>({querryTri.ptrDpq(), queryOffset.ptrD(),
+                                nodeBBox_.ptrD(), internalChildren_.ptrD(),
+                                wide, wideNodes, leafBBox, leafStride}));
+  return querryTri;
+}
+
+/**
+ * Returns a sparse array of the overlaps between the leaf bounding boxes of the
+ * other collider and this one, where i is the other's leaf index and j is this
+ * one's. The other's boxes are mapped into this one's frame if their
+ * transforms differ. The two hierarchies are traversed together, so that
+ * disjoint subtrees are pruned in one test and overlapping regions are visited
+ * once, rather than once per query. The node pairs near the roots are first
+ * expanded breadth-first into seeds, which are then searched in parallel.
+ */
+SparseIndices Collider::Collisions(const Collider& other) const {
+  if (NumLeaves() == 0 || other.NumLeaves() == 0) return SparseIndices();
+  // The COMPACT layout only keeps the wide BVH, so its binary tree is rebuilt
+  // for the traversal.
+  const bool compact = layout_ == BVHLayout::COMPACT;
+  const bool otherCompact = other.layout_ == BVHLayout::COMPACT;
+  VecDH<Box> thisBBox, otherBBox;
+  VecDH<thrust::pair<int, int>> thisChildren, otherChildren;
+  VecDH<int> wideInternal;
+  if (compact) ExpandWideNodes(thisBBox, thisChildren, wideInternal);
+  if (otherCompact) {
+    other.ExpandWideNodes(otherBBox, otherChildren, wideInternal);
+  }
+  const VecDH<Box>& nodeBBox = compact ? thisBBox : nodeBBox_;
+  const VecDH<Box>& otherNodeBBox = otherCompact ? otherBBox : other.nodeBBox_;
+  const glm::mat4x3 otherToThis =
+      queryTransform_ * glm::inverse(glm::mat4(other.queryTransform_));
+  const DualTree tree(
+      {nodeBBox.ptrD(),
+       compact ? thisChildren.ptrD() : internalChildren_.ptrD(),
+       otherNodeBBox.ptrD(),
+       otherCompact ? otherChildren.ptrD() : other.internalChildren_.ptrD(),
+       otherToThis, otherToThis != glm::mat4x3(1.0f)});
+  // Copy only the two root boxes, rather than syncing both trees to the host.
+  const Box root = nodeBBox.cbeginD()[Root()];
+  const Box otherRoot = otherNodeBBox.cbeginD()[other.Root()];
+  if (!root.DoesOverlap(tree.OtherBox(otherRoot))) return SparseIndices();
+
+  VecDH<NodePair> seeds(1, thrust::make_pair(Root(), other.Root()));
+  VecDH<int> seedOffset;
+  for (int round = 0; round < kMaxSeedRounds && seeds.size() > 0 &&
+                      seeds.size() < kMinSeeds;
+       ++round) {
+    seedOffset.resize(seeds.size() + 1, 0);
+    thrust::for_each_n(zip(seeds.cbeginD(), countAt(0)), seeds.size(),
+                       ExpandSeeds<true>({nullptr, seedOffset.ptrD(), tree}));
+    thrust::exclusive_scan(poolPolicy(), seedOffset.beginD(),
+                           seedOffset.endD(), seedOffset.beginD());
+    VecDH<NodePair> newSeeds(seedOffset.H().back());
     thrust::for_each_n(
-        zip(querriesIn.cbeginD(), countAt(0)), querriesIn.size(),
-        FindCollisions<T>({querryTri.ptrDpq(), nOverlapsD.ptrD(), maxOverlaps,
-                           nodeBBox_.ptrD(), internalChildren_.ptrD()}));
-    nOverlaps = nOverlapsD.H()[0];
-    if (nOverlaps <= maxOverlaps)
-      break;
-    else {  // if not enough memory was allocated, guess how much will be needed
-      int lastQuery = querryTri.Get(0).H().back();
-      maxOverlaps *= 2 * static_cast<float>(querriesIn.size()) / lastQuery;
-      querryTri.Resize(maxOverlaps);
-    }
+        zip(seeds.cbeginD(), countAt(0)), seeds.size(),
+        ExpandSeeds<false>({newSeeds.ptrD(), seedOffset.ptrD(), tree}));
+    seeds = std::move(newSeeds);
   }
-  // remove unused part of array
-  querryTri.Resize(nOverlaps);
-  return querryTri;
+
+  seedOffset.resize(seeds.size() + 1, 0);
+  const thrust::pair<int*, int*> noOutput(nullptr, nullptr);
+  thrust::for_each_n(
+      zip(seeds.cbeginD(), countAt(0)), seeds.size(),
+      FindDualCollisions<true>({noOutput, seedOffset.ptrD(), tree}));
+  thrust::exclusive_scan(poolPolicy(), seedOffset.beginD(), seedOffset.endD(),
+                         seedOffset.beginD());
+
+  SparseIndices otherThisLeaf(seedOffset.H().back());
+  thrust::for_each_n(zip(seeds.cbeginD(), countAt(0)), seeds.size(),
+                     FindDualCollisions<false>({otherThisLeaf.ptrDpq(),
+                                                seedOffset.ptrD(), tree}));
+  return otherThisLeaf;
 }
 
 /**
@@ -258,23 +1163,25 @@ SparseIndices Collider::Collisions(const VecDH<T>& querriesIn) const {
 void Collider::UpdateBoxes(const VecDH<Box>& leafBB) {
   ALWAYS_ASSERT(leafBB.size() == NumLeaves(), userErr,
                 "must have the same number of updated boxes as original");
-  // copy in leaf node Boxs
-  strided_range<VecDH<Box>::IterD> leaves(nodeBBox_.beginD(), nodeBBox_.endD(),
-                                          2);
-  thrust::copy(leafBB.cbeginD(), leafBB.cendD(), leaves.begin());
-  // create global counters
-  VecDH<int> counter_(NumInternal());
-  thrust::fill(counter_.beginD(), counter_.endD(), 0);
-  // kernel over leaves to save internal Boxs
-  thrust::for_each_n(
-      countAt(0), NumLeaves(),
-      BuildInternalBoxes({nodeBBox_.ptrD(), counter_.ptrD(), nodeParent_.ptrD(),
-                          internalChildren_.ptrD()}));
+  queryTransform_ = glm::mat4x3(1.0f);
+  if (layout_ == BVHLayout::COMPACT) {
+    leafBBox_ = leafBB;
+  } else {
+    VecDH<int> nodeParent(nodeBBox_.size(), -1);
+    thrust::for_each_n(
+        countAt(0), NumInternal(),
+        FindParents({nodeParent.ptrD(), internalChildren_.ptrD()}));
+    BuildBoxes(nodeBBox_, leafBB, nodeParent, internalChildren_);
+  }
+  RefitWideNodes();
 }
 
 /**
- * Apply axis-aligned transform to all bounding boxes. If transform is not
- * axis-aligned, abort and return false to indicate recalculation is necessary.
+ * Apply a transform to the collider. An axis-aligned transform is applied to
+ * all bounding boxes directly. Any other invertible transform is recorded
+ * instead, and its inverse is applied to later querries, so the boxes remain
+ * valid without being refit. If the transform is singular, abort and return
+ * false to indicate recalculation is necessary.
  */
 bool Collider::Transform(glm::mat4x3 transform) {
   bool axisAligned = true;
@@ -285,13 +1192,24 @@ bool Collider::Transform(glm::mat4x3 transform) {
     }
     if (count != 2) axisAligned = false;
   }
-  if (axisAligned) {
-    thrust::for_each(nodeBBox_.beginD(), nodeBBox_.endD(),
-                     TransformBox({transform}));
+  if (axisAligned && queryTransform_ == glm::mat4x3(1.0f)) {
+    VecDH<Box>& boxes = layout_ == BVHLayout::COMPACT ? leafBBox_ : nodeBBox_;
+    thrust::for_each(boxes.beginD(), boxes.endD(), TransformBox({transform}));
+    RefitWideNodes();
+    return true;
   }
-  return axisAligned;
+  const float determinant = glm::determinant(glm::mat3(transform));
+  if (determinant == 0.0f || !glm::isfinite(determinant)) return false;
+  queryTransform_ = queryTransform_ * glm::inverse(glm::mat4(transform));
+  return true;
 }
 
+template Collider::Collider(const VecDH<Box>&, const VecDH<uint32_t>&,
+                            bool, BVHLayout);
+
+template Collider::Collider(const VecDH<Box>&, const VecDH<uint64_t>&,
+                            bool, BVHLayout);
+
 template SparseIndices Collider::Collisions<Box>(const VecDH<Box>&) const;
 
 template SparseIndices Collider::Collisions<glm::vec3>(
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #pragma once
+#include <atomic>
 #include <functional>
 #include <memory>
 
@@ -24,6 +25,13 @@ namespace manifold {
  *  @brief The central classes of the library
  *  @{
  */
+
+/**
+ * Distinct Manifold objects may be used from different threads at once, even
+ * when they share operands or deferred results. A single object may not, not
+ * even through const methods, as these evaluate its pending transform and
+ * deferred Boolean in place.
+ */
 class Manifold {
  public:
   /** @name Creation
@@ -124,6 +132,8 @@ class Manifold {
   ///@{
   enum class OpType { ADD, SUBTRACT, INTERSECT };
   Manifold Boolean(const Manifold& second, OpType op) const;
+  static Manifold BatchBoolean(const std::vector<Manifold>& manifolds,
+                               OpType op);
   // Boolean operation shorthand
   Manifold operator+(const Manifold&) const;  // ADD (Union)
   Manifold& operator+=(const Manifold&);
@@ -135,6 +145,16 @@ class Manifold {
   std::pair<Manifold, Manifold> SplitByPlane(glm::vec3 normal,
                                              float originOffset) const;
   Manifold TrimByPlane(glm::vec3 normal, float originOffset) const;
+  static void SetLazyBoolean(bool lazy);
+  ///@}
+
+  /** @name Memory
+   *  Blocks of working memory freed by one operation are cached and handed out
+   * again to later ones, up to a limit shared by the whole library.
+   */
+  ///@{
+  static void SetMemoryCacheLimit(size_t bytes);
+  static void ReleaseMemoryCache();
   ///@}
 
   /** @name Testing hooks
@@ -153,9 +173,25 @@ class Manifold {
   Manifold(Manifold&&) noexcept;
   Manifold& operator=(Manifold&&) noexcept;
   struct Impl;
+  struct CsgNode;
 
  private:
-  std::unique_ptr<Impl> pImpl_;
+  // The Impl is shared between copies and only deep-copied when one of them is
+  // modified, so copying and transforming are O(1).
+  std::shared_ptr<Impl> pImpl_;
+  // Lazily baked into pImpl_ by GetImpl().
+  glm::mat4x3 transform_ = glm::mat4x3(1.0f);
+  // Set on copies; each copy gets new mesh IDs when its Impl is first used.
+  bool newMeshIDs_ = false;
+  // A deferred Boolean, evaluated into pImpl_ on first use. pImpl_ is null
+  // until then.
+  std::shared_ptr<CsgNode> csg_;
+
+  const Impl& GetBaseImpl() const;
+  const Impl& GetImpl() const;
+  Impl& GetMutableImpl();
+
+  static std::atomic<bool> lazyBoolean_;
   static int circularSegments_;
   static float circularAngle_;
   static float circularEdgeLength_;
@@ -132,27 +132,30 @@ __host__ __device__ thrust::pair<int, glm::vec2> Shadow01(
   return thrust::make_pair(s01, yz01);
 }
 
-__host__ __device__ int BinarySearch(
-    const thrust::pair<const int *, const int *> keys, const int size,
-    const thrust::pair<int, int> key) {
-  if (size <= 0) return -1;
-  int left = 0;
-  int right = size - 1;
-  int m;
-  thrust::pair<int, int> keyM;
-  while (1) {
-    m = right - (right - left) / 2;
-    keyM = thrust::make_pair(keys.first[m], keys.second[m]);
-    if (left == right) break;
-    if (keyM > key)
-      right = m - 1;
+// Returns the index of key in the given row of a sparse array in compressed-row
+// form, or -1 if it is not there. Each row's column is sorted.
+__host__ __device__ int SearchRow(const int *rowOffset, const int *column,
+                                  const int row, const int key) {
+  int left = rowOffset[row];
+  int right = rowOffset[row + 1];
+  const int end = right;
+  while (left < right) {
+    const int m = left + (right - left) / 2;
+    if (column[m] < key)
+      left = m + 1;
     else
-      left = m;
+      right = m;
   }
-  if (keyM == key)
-    return m;
-  else
-    return -1;
+  return left < end && column[left] == key ? left : -1;
+}
+
+// Returns the offsets of the rows of a sparse array sorted by the use_q column,
+// where row i spans [offset[i], offset[i + 1]).
+VecDH<int> RowOffsets(const SparseIndices &pq, bool use_q, int numRows) {
+  VecDH<int> rowOffset(numRows + 1);
+  thrust::lower_bound(poolPolicy(), pq.beginD(use_q), pq.endD(use_q),
+                      countAt(0), countAt(numRows + 1), rowOffset.beginD());
+  return rowOffset;
 }
 
 struct Kernel11 {
@@ -353,14 +356,16 @@ std::tuple<VecDH<int>, VecDH<float>> Shadow02(const Manifold::Impl &inP,
 };
 
 struct Kernel12 {
-  const thrust::pair<const int *, const int *> p0q2;
+  // p0q2 and p1q1 in compressed-row form, by vert and by P's edge
+  // respectively.
+  const int *rowOffset02;
+  const int *face02;
   const int *s02;
   const float *z02;
-  const int size02;
-  const thrust::pair<const int *, const int *> p1q1;
+  const int *rowOffset11;
+  const int *edgeQ11;
   const int *s11;
   const glm::vec4 *xyzz11;
-  const int size11;
   const Halfedge *halfedgesP;
   const Halfedge *halfedgesQ;
   const glm::vec3 *vertPosP;
@@ -385,9 +390,7 @@ struct Kernel12 {
     const Halfedge edge = halfedgesP[p1];
 
     for (int vert : {edge.startVert, edge.endVert}) {
-      const auto key =
-          forward ? thrust::make_pair(vert, q2) : thrust::make_pair(q2, vert);
-      const int idx = BinarySearch(p0q2, size02, key);
+      const int idx = SearchRow(rowOffset02, face02, vert, q2);
       if (idx != -1) {
         const int s = s02[idx];
         x12 += s * ((vert == edge.startVert) == forward ? 1 : -1);
@@ -406,9 +409,8 @@ struct Kernel12 {
       const int q1 = 3 * q2 + i;
       const Halfedge edge = halfedgesQ[q1];
       const int q1F = edge.IsForward() ? q1 : edge.pairedHalfedge;
-      const auto key =
-          forward ? thrust::make_pair(p1, q1F) : thrust::make_pair(q1F, p1);
-      const int idx = BinarySearch(p1q1, size11, key);
+      const int idx = forward ? SearchRow(rowOffset11, edgeQ11, p1, q1F)
+                              : SearchRow(rowOffset11, edgeQ11, q1F, p1);
       if (idx != -1) {  // s is implicitly zero for anything not found
         const int s = s11[idx];
         x12 -= s * (edge.IsForward() ? 1 : -1);
@@ -445,19 +447,21 @@ struct Kernel12 {
 std::tuple<VecDH<int>, VecDH<glm::vec3>> Intersect12(
     const Manifold::Impl &inP, const Manifold::Impl &inQ, const VecDH<int> &s02,
     const SparseIndices &p0q2, const VecDH<int> &s11, const SparseIndices &p1q1,
-    const VecDH<float> &z02, const VecDH<glm::vec4> &xyzz11,
-    SparseIndices &p1q2, bool forward) {
+    const VecDH<int> &rowOffset11, const VecDH<float> &z02,
+    const VecDH<glm::vec4> &xyzz11, SparseIndices &p1q2, bool forward) {
   VecDH<int> x12(p1q2.size());
   VecDH<glm::vec3> v12(p1q2.size());
+  // p0q2 is sorted by vert, which is in its q column when not forward.
+  const VecDH<int> rowOffset02 = RowOffsets(p0q2, !forward, inP.NumVert());
 
   thrust::for_each_n(
       zip(x12.beginD(), v12.beginD(), p1q2.beginD(!forward),
           p1q2.beginD(forward)),
       p1q2.size(),
-      Kernel12({p0q2.ptrDpq(), s02.ptrD(), z02.cptrD(), p0q2.size(),
-                p1q1.ptrDpq(), s11.ptrD(), xyzz11.cptrD(), p1q1.size(),
-                inP.halfedge_.cptrD(), inQ.halfedge_.cptrD(),
-                inP.vertPos_.cptrD(), forward}));
+      Kernel12({rowOffset02.cptrD(), p0q2.ptrD(forward), s02.cptrD(),
+                z02.cptrD(), rowOffset11.cptrD(), p1q1.ptrD(true),
+                s11.cptrD(), xyzz11.cptrD(), inP.halfedge_.cptrD(),
+                inQ.halfedge_.cptrD(), inP.vertPos_.cptrD(), forward}));
 
   p1q2.KeepFinite(v12, x12);
 
@@ -469,14 +473,17 @@ VecDH<int> Winding03(const Manifold::Impl &inP, SparseIndices &p0q2,
   // verts that are not shadowed (not in p0q2) have winding number zero.
   VecDH<int> w03(inP.NumVert(), 0);
 
-  if (!thrust::is_sorted(p0q2.beginD(reverse), p0q2.endD(reverse)))
-    thrust::sort_by_key(p0q2.beginD(reverse), p0q2.endD(reverse), s02.beginD());
+  if (!thrust::is_sorted(poolPolicy(), p0q2.beginD(reverse),
+                         p0q2.endD(reverse)))
+    thrust::sort_by_key(poolPolicy(), p0q2.beginD(reverse), p0q2.endD(reverse),
+                        s02.beginD());
   VecDH<int> w03val(w03.size());
   VecDH<int> w03vert(w03.size());
   // sum known s02 values into w03 (winding number)
   auto endPair =
-      thrust::reduce_by_key(p0q2.beginD(reverse), p0q2.endD(reverse),
-                            s02.beginD(), w03vert.beginD(), w03val.beginD());
+      thrust::reduce_by_key(poolPolicy(), p0q2.beginD(reverse),
+                            p0q2.endD(reverse), s02.beginD(), w03vert.beginD(),
+                            w03val.beginD());
   thrust::scatter(w03val.beginD(), endPair.second, w03vert.beginD(),
                   w03.beginD());
 
@@ -505,26 +512,31 @@ Boolean3::Boolean3(const Manifold::Impl &inP, const Manifold::Impl &inQ,
     return;
   }
 
+  if (kVerbose) {
+    std::cout << "P collider SAH cost = " << inP.collider_.SAHCost()
+              << ", Q collider SAH cost = " << inQ.collider_.SAHCost()
+              << std::endl;
+  }
+
   // Level 3
   // Find edge-triangle overlaps (broad phase)
+  // None of these need sorting: the order of p1q2 and p2q1 does not matter,
+  // and the vertex querries come back sorted by vertex. Kernel12 searches p2q0
+  // by its q column instead.
   p1q2_ = inQ_.EdgeCollisions(inP_);
-  p1q2_.Sort();
   if (kVerbose) std::cout << "p1q2 size = " << p1q2_.size() << std::endl;
 
   p2q1_ = inP_.EdgeCollisions(inQ_);
   p2q1_.SwapPQ();
-  p2q1_.Sort();
   if (kVerbose) std::cout << "p2q1 size = " << p2q1_.size() << std::endl;
 
   // Level 2
   // Find vertices that overlap faces in XY-projection
   SparseIndices p0q2 = inQ.VertexCollisionsZ(inP.vertPos_);
-  p0q2.Sort();
   if (kVerbose) std::cout << "p0q2 size = " << p0q2.size() << std::endl;
 
   SparseIndices p2q0 = inP.VertexCollisionsZ(inQ.vertPos_);
   p2q0.SwapPQ();
-  p2q0.Sort();
   if (kVerbose) std::cout << "p2q0 size = " << p2q0.size() << std::endl;
 
   // Find involved edge pairs from Level 3
@@ -559,12 +571,15 @@ Boolean3::Boolean3(const Manifold::Impl &inP, const Manifold::Impl &inQ,
   // Build up the intersection of the edges and triangles, keeping only those
   // that intersect, and record the direction the edge is passing through the
   // triangle.
-  std::tie(x12_, v12_) =
-      Intersect12(inP, inQ, s02, p0q2, s11, p1q1, z02, xyzz11, p1q2_, true);
+  // p1q1 is sorted by P's edge, so its rows are shared by both directions.
+  const VecDH<int> rowOffset11 =
+      RowOffsets(p1q1, false, inP.halfedge_.size());
+  std::tie(x12_, v12_) = Intersect12(inP, inQ, s02, p0q2, s11, p1q1,
+                                     rowOffset11, z02, xyzz11, p1q2_, true);
   if (kVerbose) std::cout << "x12 size = " << x12_.size() << std::endl;
 
-  std::tie(x21_, v21_) =
-      Intersect12(inQ, inP, s20, p2q0, s11, p1q1, z20, xyzz11, p2q1_, false);
+  std::tie(x21_, v21_) = Intersect12(inQ, inP, s20, p2q0, s11, p1q1,
+                                     rowOffset11, z20, xyzz11, p2q1_, false);
   if (kVerbose) std::cout << "x21 size = " << x21_.size() << std::endl;
 
   // Sum up the winding numbers of all vertices.
@@ -12,8 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <thrust/logical.h>
+
 #include <algorithm>
-#include <map>
 
 #include "boolean3.cuh"
 #include "polygon.h"
@@ -97,31 +98,34 @@ std::tuple<VecDH<int>, VecDH<int>> SizeOutput(
   VecDH<int> facePQ2R(inP.NumTri() + inQ.NumTri() + 1);
   auto keepFace =
       thrust::make_transform_iterator(sidesPerFacePQ.beginD(), NotZero());
-  thrust::inclusive_scan(keepFace, keepFace + sidesPerFacePQ.size(),
+  thrust::inclusive_scan(poolPolicy(), keepFace,
+                         keepFace + sidesPerFacePQ.size(),
                          facePQ2R.beginD() + 1);
   int numFaceR = facePQ2R.H().back();
   facePQ2R.resize(inP.NumTri() + inQ.NumTri());
 
   outR.faceNormal_.resize(numFaceR);
-  auto next = thrust::copy_if(inP.faceNormal_.beginD(), inP.faceNormal_.endD(),
-                              keepFace, outR.faceNormal_.beginD(),
+  auto next = thrust::copy_if(poolPolicy(), inP.faceNormal_.beginD(),
+                              inP.faceNormal_.endD(), keepFace,
+                              outR.faceNormal_.beginD(),
                               thrust::identity<bool>());
   if (invertQ) {
     auto start = thrust::make_transform_iterator(inQ.faceNormal_.beginD(),
                                                  thrust::negate<glm::vec3>());
     auto end = thrust::make_transform_iterator(inQ.faceNormal_.endD(),
                                                thrust::negate<glm::vec3>());
-    thrust::copy_if(start, end, keepFace + inP.NumTri(), next,
+    thrust::copy_if(poolPolicy(), start, end, keepFace + inP.NumTri(), next,
                     thrust::identity<bool>());
   } else {
-    thrust::copy_if(inQ.faceNormal_.beginD(), inQ.faceNormal_.endD(),
-                    keepFace + inP.NumTri(), next, thrust::identity<bool>());
+    thrust::copy_if(poolPolicy(), inQ.faceNormal_.beginD(),
+                    inQ.faceNormal_.endD(), keepFace + inP.NumTri(), next,
+                    thrust::identity<bool>());
   }
 
-  auto newEnd =
-      thrust::remove(sidesPerFacePQ.beginD(), sidesPerFacePQ.endD(), 0);
+  auto newEnd = thrust::remove(poolPolicy(), sidesPerFacePQ.beginD(),
+                               sidesPerFacePQ.endD(), 0);
   VecDH<int> faceEdge(newEnd - sidesPerFacePQ.beginD() + 1);
-  thrust::inclusive_scan(sidesPerFacePQ.beginD(), newEnd,
+  thrust::inclusive_scan(poolPolicy(), sidesPerFacePQ.beginD(), newEnd,
                          faceEdge.beginD() + 1);
   outR.halfedge_.resize(faceEdge.H().back());
 
@@ -134,137 +138,261 @@ struct EdgePos {
   bool isStart;
 };
 
-void AddNewEdgeVerts(
-    std::map<int, std::vector<EdgePos>> &edgesP,
-    std::map<std::pair<int, int>, std::vector<EdgePos>> &edgesNew,
-    const SparseIndices &p1q2, const VecH<int> &i12, const VecH<int> &v12R,
-    const VecH<Halfedge> &halfedgeP, bool forward) {
-  // For each edge of P that intersects a face of Q (p1q2), add this vertex to
-  // P's corresponding edge vector and to the two new edges, which are
-  // intersections between the face of Q and the two faces of P attached to the
-  // edge. The direction and duplicity are given by i12, while v12R remaps to
-  // the output vert index. When forward is false, all is reversed.
-  const VecH<int> &p1 = p1q2.Get(!forward).H();
-  const VecH<int> &q2 = p1q2.Get(forward).H();
-  for (int i = 0; i < p1q2.size(); ++i) {
-    const int edgeP = p1[i];
-    const int faceQ = q2[i];
-    const int vert = v12R[i];
-    const int inclusion = i12[i];
-
-    auto &edgePosP = edgesP[edgeP];
-
-    Halfedge halfedge = halfedgeP[edgeP];
-    std::pair<int, int> key = {halfedgeP[halfedge.pairedHalfedge].face, faceQ};
-    if (!forward) std::swap(key.first, key.second);
-    auto &edgePosRight = edgesNew[key];
-
-    key = {halfedge.face, faceQ};
-    if (!forward) std::swap(key.first, key.second);
-    auto &edgePosLeft = edgesNew[key];
-
-    EdgePos edgePos = {vert, 0.0f, inclusion < 0};
-    EdgePos edgePosRev = edgePos;
-    edgePosRev.isStart = !edgePos.isStart;
+// A Ref carries the reference of a halfedge's startVert back to the input
+// manifolds. PQ is 0 if the halfedge comes from triangle tri of P, and 1 for Q.
+// vert is 0, 1, or 2 to denote which vertex of tri it is, and -1 if it is new.
+struct Ref {
+  int PQ, tri, vert;
+};
+
+// The key of a new edge is the face of P in the high bits and the face of Q in
+// the low bits.
+__host__ __device__ uint64_t NewEdgeKey(int faceP, int faceQ) {
+  return (static_cast<uint64_t>(faceP) << 32) | static_cast<uint32_t>(faceQ);
+}
+
+struct PartialEdgeVerts {
+  int *edgeKey;
+  EdgePos *edgePos;
+  const glm::vec3 *vertPosR;
+  const glm::vec3 *vertPosP;
+  const Halfedge *halfedgeP;
+  const int firstVert;
 
+  __host__ __device__ void operator()(thrust::tuple<int, int, int> in) {
+    const int edgeP = thrust::get<0>(in);
+    const int inclusion = thrust::get<1>(in);
+    const int vert = thrust::get<2>(in);
+    const int first = vert - firstVert;
+
+    const Halfedge halfedge = halfedgeP[edgeP];
+    const glm::vec3 edgeVec =
+        vertPosP[halfedge.endVert] - vertPosP[halfedge.startVert];
+    const float pos = glm::dot(vertPosR[vert], edgeVec);
     for (int j = 0; j < glm::abs(inclusion); ++j) {
-      edgePosP.push_back(edgePos);
-      edgePosRight.push_back(forward ? edgePos : edgePosRev);
-      edgePosLeft.push_back(forward ? edgePosRev : edgePos);
-      ++edgePos.vert;
-      ++edgePosRev.vert;
+      edgeKey[first + j] = edgeP;
+      edgePos[first + j] = {vert + j, pos, inclusion < 0};
     }
   }
-}
+};
 
-std::vector<Halfedge> PairUp(std::vector<EdgePos> &edgePos) {
-  // Pair start vertices with end vertices to form edges. The choice of pairing
-  // is arbitrary for the manifoldness guarantee, but must be ordered to be
-  // geometrically valid. If the order does not go start-end-start-end... then
-  // the input and output are not geometrically valid and this algorithm becomes
-  // a heuristic.
-  ALWAYS_ASSERT(edgePos.size() % 2 == 0, topologyErr,
-                "Non-manifold edge! Not an even number of points.");
-  int nEdges = edgePos.size() / 2;
-  auto middle = std::partition(edgePos.begin(), edgePos.end(),
-                               [](EdgePos x) { return x.isStart; });
-  ALWAYS_ASSERT(middle - edgePos.begin() == nEdges, topologyErr,
-                "Non-manifold edge!");
-  auto cmp = [](EdgePos a, EdgePos b) { return a.edgePos < b.edgePos; };
-  std::sort(edgePos.begin(), middle, cmp);
-  std::sort(middle, edgePos.end(), cmp);
-  std::vector<Halfedge> edges;
-  for (int i = 0; i < nEdges; ++i)
-    edges.push_back({edgePos[i].vert, edgePos[i + nEdges].vert, -1, -1});
-  return edges;
-}
+struct CountEndVerts {
+  const Halfedge *halfedgeP;
+  const int *i03;
 
-// A Ref carries the reference of a halfedge's startVert back to the input
-// manifolds. PQ is 0 if the halfedge comes from triangle tri of P, and 1 for Q.
-// vert is 0, 1, or 2 to denote which vertex of tri it is, and -1 if it is new.
-struct Ref {
-  int PQ, tri, vert;
+  __host__ __device__ int operator()(int edgeP) {
+    const Halfedge halfedge = halfedgeP[edgeP];
+    return glm::abs(i03[halfedge.startVert]) + glm::abs(i03[halfedge.endVert]);
+  }
 };
 
-void AppendPartialEdges(Manifold::Impl &outR, VecH<bool> &wholeHalfedgeP,
-                        VecH<int> &facePtrR,
-                        std::map<int, std::vector<EdgePos>> &edgesP,
-                        VecH<Ref> &halfedgeRef, const Manifold::Impl &inP,
-                        const VecH<int> &i03, const VecH<int> &vP2R,
-                        const thrust::host_vector<int>::const_iterator faceP2R,
-                        bool forward) {
-  // Each edge in the map is partially retained; for each of these, look up
-  // their original verts and include them based on their winding number (i03),
-  // while remaping them to the output using vP2R. Use the verts position
-  // projected along the edge vector to pair them up, then distribute these
-  // edges to their faces.
-  VecH<Halfedge> &halfedgeR = outR.halfedge_.H();
-  const VecH<glm::vec3> &vertPosP = inP.vertPos_.H();
-  const VecH<Halfedge> &halfedgeP = inP.halfedge_.H();
-
-  for (auto &value : edgesP) {
-    const int edgeP = value.first;
-    std::vector<EdgePos> &edgePosP = value.second;
-
-    const Halfedge &halfedge = halfedgeP[edgeP];
-    wholeHalfedgeP[edgeP] = false;
-    wholeHalfedgeP[halfedge.pairedHalfedge] = false;
+struct EndVerts {
+  int *edgeKey;
+  EdgePos *edgePos;
+  const glm::vec3 *vertPosR;
+  const glm::vec3 *vertPosP;
+  const Halfedge *halfedgeP;
+  const int *i03;
+  const int *vP2R;
 
+  __host__ __device__ void operator()(thrust::tuple<int, int> in) {
+    const int edgeP = thrust::get<0>(in);
+    int idx = thrust::get<1>(in);
+
+    const Halfedge halfedge = halfedgeP[edgeP];
     const int vStart = halfedge.startVert;
     const int vEnd = halfedge.endVert;
     const glm::vec3 edgeVec = vertPosP[vEnd] - vertPosP[vStart];
-    // Fill in the edge positions of the old points.
-    for (EdgePos &edge : edgePosP) {
-      edge.edgePos = glm::dot(outR.vertPos_.H()[edge.vert], edgeVec);
+
+    for (const int vP : {vStart, vEnd}) {
+      const int inclusion = i03[vP];
+      const int vert = vP2R[vP];
+      const float pos = glm::dot(vertPosR[vert], edgeVec);
+      const bool isStart = vP == vStart ? inclusion > 0 : inclusion < 0;
+      for (int j = 0; j < glm::abs(inclusion); ++j) {
+        edgeKey[idx] = edgeP;
+        edgePos[idx] = {vert + j, pos, isStart};
+        ++idx;
+      }
     }
+  }
+};
 
-    int inclusion = i03[vStart];
-    bool reversed = inclusion < 0;
-    EdgePos edgePos = {vP2R[vStart],
-                       glm::dot(outR.vertPos_.H()[vP2R[vStart]], edgeVec),
-                       inclusion > 0};
+struct NewEdgeVerts {
+  uint64_t *edgeKey;
+  EdgePos *edgePos;
+  const Halfedge *halfedgeP;
+  const int firstVert;
+  const int firstRecord;
+  const bool forward;
+
+  __host__ __device__ void operator()(thrust::tuple<int, int, int, int> in) {
+    const int edgeP = thrust::get<0>(in);
+    const int faceQ = thrust::get<1>(in);
+    const int inclusion = thrust::get<2>(in);
+    const int vert = thrust::get<3>(in);
+    const int first = firstRecord + 2 * (vert - firstVert);
+
+    // The new vert lies on the two new edges between faceQ and the two faces
+    // of P attached to edgeP.
+    const Halfedge halfedge = halfedgeP[edgeP];
+    const int faceRight = halfedgeP[halfedge.pairedHalfedge].face;
+    const int faceLeft = halfedge.face;
+    const uint64_t keyRight = forward ? NewEdgeKey(faceRight, faceQ)
+                                      : NewEdgeKey(faceQ, faceRight);
+    const uint64_t keyLeft =
+        forward ? NewEdgeKey(faceLeft, faceQ) : NewEdgeKey(faceQ, faceLeft);
+
+    const bool isStart = inclusion < 0;
     for (int j = 0; j < glm::abs(inclusion); ++j) {
-      edgePosP.push_back(edgePos);
-      ++edgePos.vert;
+      edgeKey[first + 2 * j] = keyRight;
+      edgePos[first + 2 * j] = {vert + j, 0.0f, forward == isStart};
+      edgeKey[first + 2 * j + 1] = keyLeft;
+      edgePos[first + 2 * j + 1] = {vert + j, 0.0f, forward != isStart};
     }
+  }
+};
 
-    inclusion = i03[vEnd];
-    reversed |= inclusion < 0;
-    edgePos = {vP2R[vEnd], glm::dot(outR.vertPos_.H()[vP2R[vEnd]], edgeVec),
-               inclusion < 0};
-    for (int j = 0; j < glm::abs(inclusion); ++j) {
-      edgePosP.push_back(edgePos);
-      ++edgePos.vert;
+struct NewEdgePos {
+  EdgePos *edgePos;
+  const int *runOffset;
+  const glm::vec3 *vertPosR;
+
+  __host__ __device__ void operator()(int run) {
+    const int begin = runOffset[run];
+    const int end = runOffset[run + 1];
+    Box bbox;
+    for (int i = begin; i < end; ++i) {
+      bbox.Union(vertPosR[edgePos[i].vert]);
     }
+    const glm::vec3 size = bbox.Size();
+    // Order the points along their longest dimension.
+    const int dim = (size.x > size.y && size.x > size.z) ? 0
+                    : size.y > size.z                    ? 1
+                                                         : 2;
+    for (int i = begin; i < end; ++i) {
+      edgePos[i].edgePos = vertPosR[edgePos[i].vert][dim];
+    }
+  }
+};
+
+// Orders the verts of each edge with the start verts first, and each half
+// along the edge, ready to be paired up.
+template <typename Key>
+struct EdgePosLess {
+  __host__ __device__ bool operator()(thrust::tuple<Key, EdgePos> a,
+                                      thrust::tuple<Key, EdgePos> b) const {
+    const Key keyA = thrust::get<0>(a);
+    const Key keyB = thrust::get<0>(b);
+    if (keyA != keyB) return keyA < keyB;
+    const EdgePos x = thrust::get<1>(a);
+    const EdgePos y = thrust::get<1>(b);
+    if (x.isStart != y.isStart) return x.isStart;
+    if (x.edgePos != y.edgePos) return x.edgePos < y.edgePos;
+    return x.vert < y.vert;
+  }
+};
+
+template <typename Key>
+void SortEdgePos(VecDH<Key> &edgeKey, VecDH<EdgePos> &edgePos) {
+  thrust::sort(poolPolicy(), zip(edgeKey.beginD(), edgePos.beginD()),
+               zip(edgeKey.endD(), edgePos.endD()), EdgePosLess<Key>());
+}
+
+// Returns the offsets of the runs of each of the sorted, unique runKeys in the
+// sorted edgeKey, with the total appended.
+template <typename Key>
+VecDH<int> RunOffsets(const VecDH<Key> &edgeKey, const VecDH<Key> &runKeys) {
+  VecDH<int> runOffset(runKeys.size() + 1);
+  thrust::lower_bound(poolPolicy(), edgeKey.beginD(), edgeKey.endD(),
+                      runKeys.beginD(), runKeys.endD(), runOffset.beginD());
+  thrust::fill(runOffset.beginD() + runKeys.size(), runOffset.endD(),
+               edgeKey.size());
+  return runOffset;
+}
+
+struct EvenRun {
+  const int *runOffset;
+
+  __host__ __device__ bool operator()(int run) {
+    return (runOffset[run + 1] - runOffset[run]) % 2 == 0;
+  }
+};
+
+struct PairedRun {
+  const int *runOffset;
+  const EdgePos *edgePos;
+
+  __host__ __device__ bool operator()(int run) {
+    const int begin = runOffset[run];
+    const int half = (runOffset[run + 1] - begin) / 2;
+    return half == 0 || (edgePos[begin + half - 1].isStart &&
+                         !edgePos[begin + half].isStart);
+  }
+};
 
-    // sort edges into start/end pairs along length
-    std::vector<Halfedge> edges = PairUp(edgePosP);
+void CheckPairs(const VecDH<int> &runOffset, const VecDH<EdgePos> &edgePos) {
+  // Start vertices are paired with end vertices to form edges. The choice of
+  // pairing is arbitrary for the manifoldness guarantee, but must be ordered to
+  // be geometrically valid. If the order does not go start-end-start-end...
+  // then the input and output are not geometrically valid and this algorithm
+  // becomes a heuristic. Each run is sorted by EdgePosLess, so AddEdges pairs
+  // its ith start vert with its ith end vert; this checks there are as many of
+  // each.
+  const int numRun = runOffset.size() - 1;
+  ALWAYS_ASSERT(
+      thrust::all_of(poolPolicy(), countAt(0), countAt(numRun),
+                     EvenRun({runOffset.cptrD()})),
+      topologyErr, "Non-manifold edge! Not an even number of points.");
+  ALWAYS_ASSERT(
+      thrust::all_of(poolPolicy(), countAt(0), countAt(numRun),
+                     PairedRun({runOffset.cptrD(), edgePos.cptrD()})),
+      topologyErr, "Non-manifold edge!");
+}
+
+__host__ __device__ void AddEdges(Halfedge *halfedgeR, Ref *halfedgeRef,
+                                  int *facePtr, const EdgePos *edgePos,
+                                  int begin, int end, int faceLeft,
+                                  int faceRight, Ref forwardRef,
+                                  Ref backwardRef) {
+  const int nEdges = (end - begin) / 2;
+  for (int i = begin; i < begin + nEdges; ++i) {
+    const int forwardEdge = AtomicAdd(facePtr[faceLeft], 1);
+    const int backwardEdge = AtomicAdd(facePtr[faceRight], 1);
+    const int startVert = edgePos[i].vert;
+    const int endVert = edgePos[i + nEdges].vert;
+
+    halfedgeR[forwardEdge] = {startVert, endVert, backwardEdge, faceLeft};
+    halfedgeRef[forwardEdge] = forwardRef;
+    halfedgeR[backwardEdge] = {endVert, startVert, forwardEdge, faceRight};
+    halfedgeRef[backwardEdge] = backwardRef;
+  }
+}
 
-    // add halfedges to result
+struct AppendPartial {
+  Halfedge *halfedgeR;
+  Ref *halfedgeRef;
+  int *facePtr;
+  bool *wholeHalfedgeP;
+  const EdgePos *edgePos;
+  const int *runOffset;
+  const Halfedge *halfedgeP;
+  const int *i03;
+  const int *faceP2R;
+  const bool forward;
+
+  __host__ __device__ void operator()(thrust::tuple<int, int> in) {
+    const int edgeP = thrust::get<0>(in);
+    const int run = thrust::get<1>(in);
+
+    const Halfedge halfedge = halfedgeP[edgeP];
+    wholeHalfedgeP[edgeP] = false;
+    wholeHalfedgeP[halfedge.pairedHalfedge] = false;
+
+    const bool reversed =
+        i03[halfedge.startVert] < 0 || i03[halfedge.endVert] < 0;
     const int faceLeftP = halfedge.face;
-    const int faceLeft = faceP2R[faceLeftP];
     const int faceRightP = halfedgeP[halfedge.pairedHalfedge].face;
-    const int faceRight = faceP2R[faceRightP];
     // Negative inclusion means the halfedges are reversed, which means our
     // reference is now to the endVert instead of the startVert, which is one
     // position advanced CCW. This is only valid if this is a retained vert; it
@@ -275,74 +403,137 @@ void AppendPartialEdges(Manifold::Impl &outR, VecH<bool> &wholeHalfedgeP,
         forward ? 0 : 1, faceRightP,
         (halfedge.pairedHalfedge + (reversed ? 1 : 0)) % 3};
 
-    for (Halfedge e : edges) {
-      const int forwardEdge = facePtrR[faceLeft]++;
-      const int backwardEdge = facePtrR[faceRight]++;
-
-      e.face = faceLeft;
-      e.pairedHalfedge = backwardEdge;
-      halfedgeR[forwardEdge] = e;
-      halfedgeRef[forwardEdge] = forwardRef;
-
-      std::swap(e.startVert, e.endVert);
-      e.face = faceRight;
-      e.pairedHalfedge = forwardEdge;
-      halfedgeR[backwardEdge] = e;
-      halfedgeRef[backwardEdge] = backwardRef;
-    }
+    AddEdges(halfedgeR, halfedgeRef, facePtr, edgePos, runOffset[run],
+             runOffset[run + 1], faceP2R[faceLeftP], faceP2R[faceRightP],
+             forwardRef, backwardRef);
   }
-}
-
-void AppendNewEdges(
-    Manifold::Impl &outR, VecH<int> &facePtrR,
-    std::map<std::pair<int, int>, std::vector<EdgePos>> &edgesNew,
-    VecH<Ref> &halfedgeRef, const VecH<int> &facePQ2R, const int numFaceP) {
-  // Pair up each edge's verts and distribute to faces based on indices in key.
-  VecH<Halfedge> &halfedgeR = outR.halfedge_.H();
-  VecH<glm::vec3> &vertPosR = outR.vertPos_.H();
-
-  for (auto &value : edgesNew) {
-    const int faceP = value.first.first;
-    const int faceQ = value.first.second;
-    std::vector<EdgePos> &edgePos = value.second;
+};
 
-    Box bbox;
-    for (auto edge : edgePos) {
-      bbox.Union(vertPosR[edge.vert]);
-    }
-    const glm::vec3 size = bbox.Size();
-    // Order the points along their longest dimension.
-    const int i = (size.x > size.y && size.x > size.z) ? 0
-                  : size.y > size.z                    ? 1
-                                                       : 2;
-    for (auto &edge : edgePos) {
-      edge.edgePos = vertPosR[edge.vert][i];
-    }
+struct AppendNew {
+  Halfedge *halfedgeR;
+  Ref *halfedgeRef;
+  int *facePtr;
+  const EdgePos *edgePos;
+  const int *runOffset;
+  const int *facePQ2R;
+  const int numFaceP;
 
-    // sort edges into start/end pairs along length.
-    std::vector<Halfedge> edges = PairUp(edgePos);
+  __host__ __device__ void operator()(thrust::tuple<uint64_t, int> in) {
+    const uint64_t key = thrust::get<0>(in);
+    const int run = thrust::get<1>(in);
+    const int faceP = key >> 32;
+    const int faceQ = key & 0xFFFFFFFFu;
 
-    // add halfedges to result
-    const int faceLeft = facePQ2R[faceP];
-    const int faceRight = facePQ2R[numFaceP + faceQ];
     const Ref forwardRef = {0, faceP, -4};
     const Ref backwardRef = {1, faceQ, -4};
-    for (Halfedge e : edges) {
-      const int forwardEdge = facePtrR[faceLeft]++;
-      const int backwardEdge = facePtrR[faceRight]++;
+    AddEdges(halfedgeR, halfedgeRef, facePtr, edgePos, runOffset[run],
+             runOffset[run + 1], facePQ2R[faceP], facePQ2R[numFaceP + faceQ],
+             forwardRef, backwardRef);
+  }
+};
 
-      e.face = faceLeft;
-      e.pairedHalfedge = backwardEdge;
-      halfedgeR[forwardEdge] = e;
-      halfedgeRef[forwardEdge] = forwardRef;
+void AppendPartialEdges(Manifold::Impl &outR, VecDH<bool> &wholeHalfedgeP,
+                        VecDH<int> &facePtrR, VecDH<Ref> &halfedgeRef,
+                        const Manifold::Impl &inP, const SparseIndices &p1q2,
+                        const VecDH<int> &i12, const VecDH<int> &v12R,
+                        int firstVert, int numNew, const VecDH<int> &i03,
+                        const VecDH<int> &vP2R, const int *faceP2R,
+                        bool forward) {
+  // Each edge of P that intersects a face of Q (p1q2) is partially retained.
+  // Its new verts are recorded with their direction and duplicity given by
+  // i12, while v12R remaps them to the output vert index. Each edge then adds
+  // its original verts based on their winding number (i03), remapped to the
+  // output using vP2R. Their positions projected along the edge vector are
+  // used to pair them up, and these edges are distributed to their faces. When
+  // forward is false, all is reversed.
+  VecDH<int> edgeKey(numNew);
+  VecDH<EdgePos> edgePos(numNew);
+  thrust::for_each_n(
+      zip(p1q2.beginD(!forward), i12.beginD(), v12R.beginD()), i12.size(),
+      PartialEdgeVerts({edgeKey.ptrD(), edgePos.ptrD(), outR.vertPos_.cptrD(),
+                        inP.vertPos_.cptrD(), inP.halfedge_.cptrD(),
+                        firstVert}));
+
+  VecDH<int> edges = p1q2.Copy(!forward);
+  thrust::sort(poolPolicy(), edges.beginD(), edges.endD());
+  edges.resize(thrust::unique(poolPolicy(), edges.beginD(), edges.endD()) -
+               edges.beginD());
+
+  VecDH<int> endOffset(edges.size());
+  thrust::transform_exclusive_scan(
+      poolPolicy(), edges.beginD(), edges.endD(), endOffset.beginD(),
+      CountEndVerts({inP.halfedge_.cptrD(), i03.cptrD()}), numNew,
+      thrust::plus<int>());
+  const int numRecord =
+      edges.size() == 0
+          ? numNew
+          : endOffset.H().back() +
+                CountEndVerts({inP.halfedge_.cptrH(),
+                               i03.cptrH()})(edges.H().back());
+  edgeKey.resize(numRecord);
+  edgePos.resize(numRecord);
+  thrust::for_each_n(
+      zip(edges.beginD(), endOffset.beginD()), edges.size(),
+      EndVerts({edgeKey.ptrD(), edgePos.ptrD(), outR.vertPos_.cptrD(),
+                inP.vertPos_.cptrD(), inP.halfedge_.cptrD(), i03.cptrD(),
+                vP2R.cptrD()}));
 
-      std::swap(e.startVert, e.endVert);
-      e.face = faceRight;
-      e.pairedHalfedge = forwardEdge;
-      halfedgeR[backwardEdge] = e;
-      halfedgeRef[backwardEdge] = backwardRef;
-    }
-  }
+  SortEdgePos(edgeKey, edgePos);
+  const VecDH<int> runOffset = RunOffsets(edgeKey, edges);
+  CheckPairs(runOffset, edgePos);
+
+  thrust::for_each_n(
+      zip(edges.beginD(), countAt(0)), edges.size(),
+      AppendPartial({outR.halfedge_.ptrD(), halfedgeRef.ptrD(),
+                     facePtrR.ptrD(), wholeHalfedgeP.ptrD(), edgePos.cptrD(),
+                     runOffset.cptrD(), inP.halfedge_.cptrD(), i03.cptrD(),
+                     faceP2R, forward}));
+}
+
+void AppendNewEdges(Manifold::Impl &outR, VecDH<int> &facePtrR,
+                    VecDH<Ref> &halfedgeRef, const Manifold::Impl &inP,
+                    const Manifold::Impl &inQ, const SparseIndices &p1q2,
+                    const VecDH<int> &i12, const VecDH<int> &v12R,
+                    const SparseIndices &p2q1, const VecDH<int> &i21,
+                    const VecDH<int> &v21R, int firstVert, int n12, int n21,
+                    const VecDH<int> &facePQ2R) {
+  // Each intersection of an edge with a face adds a vert to the two new edges
+  // between that face and the two faces of the other manifold attached to the
+  // edge. The new edges are keyed by their pair of faces, and their verts are
+  // paired up along the longest dimension of their bounding box and
+  // distributed to their faces.
+  VecDH<uint64_t> edgeKey(2 * (n12 + n21));
+  VecDH<EdgePos> edgePos(2 * (n12 + n21));
+  thrust::for_each_n(
+      zip(p1q2.beginD(0), p1q2.beginD(1), i12.beginD(), v12R.beginD()),
+      i12.size(),
+      NewEdgeVerts({edgeKey.ptrD(), edgePos.ptrD(), inP.halfedge_.cptrD(),
+                    firstVert, 0, true}));
+  thrust::for_each_n(
+      zip(p2q1.beginD(1), p2q1.beginD(0), i21.beginD(), v21R.beginD()),
+      i21.size(),
+      NewEdgeVerts({edgeKey.ptrD(), edgePos.ptrD(), inQ.halfedge_.cptrD(),
+                    firstVert + n12, 2 * n12, false}));
+
+  thrust::sort_by_key(poolPolicy(), edgeKey.beginD(), edgeKey.endD(),
+                      edgePos.beginD());
+  VecDH<uint64_t> edges(edgeKey.size());
+  edges.resize(thrust::unique_copy(poolPolicy(), edgeKey.beginD(),
+                                   edgeKey.endD(), edges.beginD()) -
+               edges.beginD());
+  const VecDH<int> runOffset = RunOffsets(edgeKey, edges);
+
+  thrust::for_each_n(countAt(0), edges.size(),
+                     NewEdgePos({edgePos.ptrD(), runOffset.cptrD(),
+                                 outR.vertPos_.cptrD()}));
+  SortEdgePos(edgeKey, edgePos);
+  CheckPairs(runOffset, edgePos);
+
+  thrust::for_each_n(
+      zip(edges.beginD(), countAt(0)), edges.size(),
+      AppendNew({outR.halfedge_.ptrD(), halfedgeRef.ptrD(), facePtrR.ptrD(),
+                 edgePos.cptrD(), runOffset.cptrD(), facePQ2R.cptrD(),
+                 inP.NumTri()}));
 }
 
 struct DuplicateHalfedges {
@@ -413,10 +604,39 @@ void AppendWholeEdges(Manifold::Impl &outR, VecDH<int> &facePtrR,
                           vP2R.cptrD(), faceP2R, forward}));
 }
 
+__host__ __device__ BaryRef OldRef(Ref halfedgeRef, const BaryRef *triBaryP,
+                                   const BaryRef *triBaryQ) {
+  return halfedgeRef.PQ == 0 ? triBaryP[halfedgeRef.tri]
+                             : triBaryQ[halfedgeRef.tri];
+}
+
+// New verts always need a barycentric of their own, while retained verts only
+// need one if they were not a corner of their original triangle. This is
+// shared by the count and fill passes so that they agree.
+__host__ __device__ bool AddsBarycentric(const BaryRef &oldRef, Ref halfedgeRef,
+                                         Halfedge halfedgeR, int firstNewVert) {
+  return halfedgeR.startVert >= firstNewVert ||
+         oldRef.vertBary[halfedgeRef.vert] >= 0;
+}
+
+struct CountBarycentric {
+  const int firstNewVert;
+  const BaryRef *triBaryP;
+  const BaryRef *triBaryQ;
+
+  __host__ __device__ void operator()(
+      thrust::tuple<int &, Ref, Halfedge> inOut) {
+    const Ref halfedgeRef = thrust::get<1>(inOut);
+    const BaryRef oldRef = OldRef(halfedgeRef, triBaryP, triBaryQ);
+    thrust::get<0>(inOut) =
+        AddsBarycentric(oldRef, halfedgeRef, thrust::get<2>(inOut),
+                        firstNewVert);
+  }
+};
+
 struct CreateBarycentric {
   glm::vec3 *barycentricR;
   BaryRef *faceRef;
-  int *idx;
   const int firstNewVert;
   const glm::vec3 *vertPosR;
   const glm::vec3 *vertPosP;
@@ -432,6 +652,7 @@ struct CreateBarycentric {
 
   __host__ __device__ void operator()(
       thrust::tuple<int &, Ref, Halfedge> inOut) {
+    // On input, the index of the barycentric this halfedge adds, if any.
     int &halfedgeBary = thrust::get<0>(inOut);
     const Ref halfedgeRef = thrust::get<1>(inOut);
     const Halfedge halfedgeR = thrust::get<2>(inOut);
@@ -439,22 +660,16 @@ struct CreateBarycentric {
     const glm::vec3 *barycentric =
         halfedgeRef.PQ == 0 ? barycentricP : barycentricQ;
     const int tri = halfedgeRef.tri;
-    const BaryRef oldRef = halfedgeRef.PQ == 0 ? triBaryP[tri] : triBaryQ[tri];
+    const BaryRef oldRef = OldRef(halfedgeRef, triBaryP, triBaryQ);
 
     faceRef[halfedgeR.face] = oldRef;
 
-    if (halfedgeR.startVert < firstNewVert) {  // retained vert
-      int i = halfedgeRef.vert;
-      const int bary = oldRef.vertBary[i];
-      if (bary < 0) {
-        halfedgeBary = bary;
-      } else {
-        halfedgeBary = AtomicAdd(*idx, 1);
-        barycentricR[halfedgeBary] = barycentric[bary];
-      }
+    if (!AddsBarycentric(oldRef, halfedgeRef, halfedgeR, firstNewVert)) {
+      halfedgeBary = oldRef.vertBary[halfedgeRef.vert];
+    } else if (halfedgeR.startVert < firstNewVert) {  // retained vert
+      barycentricR[halfedgeBary] =
+          barycentric[oldRef.vertBary[halfedgeRef.vert]];
     } else {  // new vert
-      halfedgeBary = AtomicAdd(*idx, 1);
-
       const glm::vec3 *vertPos = halfedgeRef.PQ == 0 ? vertPosP : vertPosQ;
       const Halfedge *halfedge = halfedgeRef.PQ == 0 ? halfedgeP : halfedgeQ;
 
@@ -477,22 +692,34 @@ std::pair<VecDH<BaryRef>, VecDH<int>> CalculateMeshRelation(
     Manifold::Impl &outR, const VecDH<Ref> &halfedgeRef,
     const Manifold::Impl &inP, const Manifold::Impl &inQ, int firstNewVert,
     int numFaceR, bool invertQ) {
-  outR.meshRelation_.barycentric.resize(outR.halfedge_.size());
-  VecDH<BaryRef> faceRef(numFaceR);
+  // Count the barycentric coordinates each halfedge adds and scan them for
+  // their indices, rather than handing them out with a shared atomic counter.
+  VecDH<int> newBary(halfedgeRef.size());
+  thrust::for_each_n(
+      zip(newBary.beginD(), halfedgeRef.beginD(), outR.halfedge_.cbeginD()),
+      halfedgeRef.size(),
+      CountBarycentric({firstNewVert, inP.meshRelation_.triBary.cptrD(),
+                        inQ.meshRelation_.triBary.cptrD()}));
   VecDH<int> halfedgeBary(halfedgeRef.size());
-  VecDH<int> idx(1, 0);
+  thrust::exclusive_scan(poolPolicy(), newBary.beginD(), newBary.endD(),
+                         halfedgeBary.beginD());
+  const int numBary = halfedgeRef.size() == 0
+                          ? 0
+                          : halfedgeBary.H().back() + newBary.H().back();
+
+  outR.meshRelation_.barycentric.resize(numBary);
+  VecDH<BaryRef> faceRef(numFaceR);
   thrust::for_each_n(
       zip(halfedgeBary.beginD(), halfedgeRef.beginD(),
           outR.halfedge_.cbeginD()),
       halfedgeRef.size(),
       CreateBarycentric(
-          {outR.meshRelation_.barycentric.ptrD(), faceRef.ptrD(), idx.ptrD(),
-           firstNewVert, outR.vertPos_.cptrD(), inP.vertPos_.cptrD(),
-           inQ.vertPos_.cptrD(), inP.halfedge_.cptrD(), inQ.halfedge_.cptrD(),
+          {outR.meshRelation_.barycentric.ptrD(), faceRef.ptrD(), firstNewVert,
+           outR.vertPos_.cptrD(), inP.vertPos_.cptrD(), inQ.vertPos_.cptrD(),
+           inP.halfedge_.cptrD(), inQ.halfedge_.cptrD(),
            inP.meshRelation_.triBary.cptrD(), inQ.meshRelation_.triBary.cptrD(),
            inP.meshRelation_.barycentric.cptrD(),
            inQ.meshRelation_.barycentric.cptrD(), invertQ, outR.precision_}));
-  outR.meshRelation_.barycentric.resize(idx.H()[0]);
   return std::make_pair(faceRef, halfedgeBary);
 }
 }  // namespace
@@ -556,28 +783,29 @@ Manifold::Impl Boolean3::Result(Manifold::OpType op) const {
   thrust::transform(w30_.beginD(), w30_.endD(), i30.beginD(), c2 + c3 * _1);
 
   VecDH<int> vP2R(inP_.NumVert());
-  thrust::exclusive_scan(i03.beginD(), i03.endD(), vP2R.beginD(), 0, AbsSum());
+  thrust::exclusive_scan(poolPolicy(), i03.beginD(), i03.endD(), vP2R.beginD(),
+                         0, AbsSum());
   int numVertR = AbsSum()(vP2R.H().back(), i03.H().back());
   const int nPv = numVertR;
 
   VecDH<int> vQ2R(inQ_.NumVert());
-  thrust::exclusive_scan(i30.beginD(), i30.endD(), vQ2R.beginD(), numVertR,
-                         AbsSum());
+  thrust::exclusive_scan(poolPolicy(), i30.beginD(), i30.endD(), vQ2R.beginD(),
+                         numVertR, AbsSum());
   numVertR = AbsSum()(vQ2R.H().back(), i30.H().back());
   const int nQv = numVertR - nPv;
 
   VecDH<int> v12R(v12_.size());
   if (v12_.size() > 0) {
-    thrust::exclusive_scan(i12.beginD(), i12.endD(), v12R.beginD(), numVertR,
-                           AbsSum());
+    thrust::exclusive_scan(poolPolicy(), i12.beginD(), i12.endD(),
+                           v12R.beginD(), numVertR, AbsSum());
     numVertR = AbsSum()(v12R.H().back(), i12.H().back());
   }
   const int n12 = numVertR - nPv - nQv;
 
   VecDH<int> v21R(v21_.size());
   if (v21_.size() > 0) {
-    thrust::exclusive_scan(i21.beginD(), i21.endD(), v21R.beginD(), numVertR,
-                           AbsSum());
+    thrust::exclusive_scan(poolPolicy(), i21.beginD(), i21.endD(),
+                           v21R.beginD(), numVertR, AbsSum());
     numVertR = AbsSum()(v21R.H().back(), i21.H().back());
   }
   const int n21 = numVertR - nPv - nQv - n12;
@@ -609,21 +837,7 @@ Manifold::Impl Boolean3::Result(Manifold::OpType op) const {
     std::cout << n21 << " new verts from facesP -> edgesQ" << std::endl;
   }
 
-  // Build up new polygonal faces from triangle intersections. At this point the
-  // calculation switches from parallel to serial.
-
-  // Level 3
-
-  // This key is the forward halfedge index of P or Q. Only includes intersected
-  // edges.
-  std::map<int, std::vector<EdgePos>> edgesP, edgesQ;
-  // This key is the face index of <P, Q>
-  std::map<std::pair<int, int>, std::vector<EdgePos>> edgesNew;
-
-  AddNewEdgeVerts(edgesP, edgesNew, p1q2_, i12.H(), v12R.H(),
-                  inP_.halfedge_.H(), true);
-  AddNewEdgeVerts(edgesQ, edgesNew, p2q1_, i21.H(), v21R.H(),
-                  inQ_.halfedge_.H(), false);
+  // Build up new polygonal faces from triangle intersections.
 
   // Level 4
   VecDH<int> faceEdge;
@@ -642,15 +856,16 @@ Manifold::Impl Boolean3::Result(Manifold::OpType op) const {
   // are triangulated.
   VecDH<Ref> halfedgeRef(2 * outR.NumEdge());
 
-  AppendPartialEdges(outR, wholeHalfedgeP.H(), facePtrR.H(), edgesP,
-                     halfedgeRef.H(), inP_, i03.H(), vP2R.H(), facePQ2R.begin(),
+  // Level 3
+  AppendPartialEdges(outR, wholeHalfedgeP, facePtrR, halfedgeRef, inP_, p1q2_,
+                     i12, v12R, nPv + nQv, n12, i03, vP2R, facePQ2R.cptrD(),
                      true);
-  AppendPartialEdges(outR, wholeHalfedgeQ.H(), facePtrR.H(), edgesQ,
-                     halfedgeRef.H(), inQ_, i30.H(), vQ2R.H(),
-                     facePQ2R.begin() + inP_.NumTri(), false);
+  AppendPartialEdges(outR, wholeHalfedgeQ, facePtrR, halfedgeRef, inQ_, p2q1_,
+                     i21, v21R, nPv + nQv + n12, n21, i30, vQ2R,
+                     facePQ2R.cptrD() + inP_.NumTri(), false);
 
-  AppendNewEdges(outR, facePtrR.H(), edgesNew, halfedgeRef.H(), facePQ2R.H(),
-                 inP_.NumTri());
+  AppendNewEdges(outR, facePtrR, halfedgeRef, inP_, inQ_, p1q2_, i12, v12R,
+                 p2q1_, i21, v21R, nPv + nQv, n12, n21, facePQ2R);
 
   AppendWholeEdges(outR, facePtrR, halfedgeRef, inP_, wholeHalfedgeP, i03, vP2R,
                    facePQ2R.cptrD(), true);
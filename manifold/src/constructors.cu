@@ -14,10 +14,7 @@
 
 #include <thrust/sequence.h>
 
-#include <boost/config.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/connected_components.hpp>
-
+#include "csg_tree.cuh"
 #include "impl.cuh"
 #include "polygon.h"
 
@@ -58,19 +55,22 @@ struct UpdateHalfedge {
   }
 };
 
+struct LinkVerts {
+  int* parent;
+
+  __host__ __device__ void operator()(const Halfedge& halfedge) {
+    if (halfedge.IsForward())
+      UnionRoots(parent, halfedge.startVert, halfedge.endVert);
+  }
+};
+
 int ConnectedComponents(VecDH<int>& components, int numVert,
                         const VecDH<Halfedge>& halfedges) {
-  boost::adjacency_list<boost::vecS, boost::vecS, boost::undirectedS> graph(
-      numVert);
-  for (int i = 0; i < halfedges.size(); ++i) {
-    const Halfedge halfedge = halfedges.H()[i];
-    if (halfedge.IsForward()) {
-      boost::add_edge(halfedge.startVert, halfedge.endVert, graph);
-    }
-  }
   components.resize(numVert);
-  int numComponent = boost::connected_components(graph, components.H().data());
-  return numComponent;
+  thrust::sequence(components.beginD(), components.endD());
+  thrust::for_each(halfedges.beginD(), halfedges.endD(),
+                   LinkVerts({components.ptrD()}));
+  return LabelComponents(components);
 }
 
 struct Equals {
@@ -134,7 +134,7 @@ Manifold Manifold::Smooth(const Mesh& mesh,
  */
 Manifold Manifold::Tetrahedron() {
   Manifold tetrahedron;
-  tetrahedron.pImpl_ = std::make_unique<Impl>(Impl::Shape::TETRAHEDRON);
+  tetrahedron.pImpl_ = std::make_shared<Impl>(Impl::Shape::TETRAHEDRON);
   return tetrahedron;
 }
 
@@ -145,7 +145,7 @@ Manifold Manifold::Tetrahedron() {
  */
 Manifold Manifold::Cube(glm::vec3 size, bool center) {
   Manifold cube;
-  cube.pImpl_ = std::make_unique<Impl>(Impl::Shape::CUBE);
+  cube.pImpl_ = std::make_shared<Impl>(Impl::Shape::CUBE);
   cube.Scale(size);
   if (center) cube.Translate(-size / 2.0f);
   return cube;
@@ -159,7 +159,7 @@ Manifold Manifold::Cube(glm::vec3 size, bool center) {
 Manifold Manifold::Cylinder(float height, float radiusLow, float radiusHigh,
                             int circularSegments, bool center) {
   float scale = radiusHigh >= 0.0f ? radiusHigh / radiusLow : 1.0f;
-  float radius = max(radiusLow, radiusHigh);
+  float radius = std::max(radiusLow, radiusHigh);
   int n = circularSegments > 2 ? circularSegments : GetCircularSegments(radius);
   Polygons circle(1);
   float dPhi = 360.0f / n;
@@ -183,7 +183,7 @@ Manifold Manifold::Sphere(float radius, int circularSegments) {
   int n = circularSegments > 0 ? (circularSegments + 3) / 4
                                : GetCircularSegments(radius) / 4;
   Manifold sphere;
-  sphere.pImpl_ = std::make_unique<Impl>(Impl::Shape::OCTAHEDRON);
+  sphere.pImpl_ = std::make_shared<Impl>(Impl::Shape::OCTAHEDRON);
   sphere.pImpl_->Subdivide(n);
   thrust::for_each_n(sphere.pImpl_->vertPos_.beginD(), sphere.NumVert(),
                      ToSphere({radius}));
@@ -274,7 +274,7 @@ Manifold Manifold::Revolve(const Polygons& crossSection, int circularSegments) {
   float radius = 0.0f;
   for (const auto& poly : crossSection) {
     for (const auto& vert : poly) {
-      radius = max(radius, vert.pos.x);
+      radius = std::max(radius, vert.pos.x);
     }
   }
   int nDivisions =
@@ -372,7 +372,7 @@ Manifold Manifold::Compose(const std::vector<Manifold>& manifolds) {
     numVert += manifold.NumVert();
     numEdge += manifold.NumEdge();
     numTri += manifold.NumTri();
-    numBary += manifold.pImpl_->meshRelation_.barycentric.size();
+    numBary += manifold.GetImpl().meshRelation_.barycentric.size();
   }
 
   Manifold out;
@@ -389,8 +389,7 @@ Manifold Manifold::Compose(const std::vector<Manifold>& manifolds) {
   int nextTri = 0;
   int nextBary = 0;
   for (const Manifold& manifold : manifolds) {
-    const Impl& impl = *(manifold.pImpl_);
-    impl.ApplyTransform();
+    const Impl& impl = manifold.GetImpl();
 
     thrust::copy(impl.vertPos_.beginD(), impl.vertPos_.endD(),
                  combined.vertPos_.beginD() + nextVert);
@@ -425,8 +424,9 @@ Manifold Manifold::Compose(const std::vector<Manifold>& manifolds) {
  * that are topologically disconnected.
  */
 std::vector<Manifold> Manifold::Decompose() const {
+  const Impl& base = GetBaseImpl();
   VecDH<int> vertLabel;
-  int numLabel = ConnectedComponents(vertLabel, NumVert(), pImpl_->halfedge_);
+  int numLabel = ConnectedComponents(vertLabel, NumVert(), base.halfedge_);
 
   if (numLabel == 1) {
     std::vector<Manifold> meshes(1);
@@ -440,8 +440,8 @@ std::vector<Manifold> Manifold::Decompose() const {
     VecDH<int> vertNew2Old(NumVert());
     int nVert =
         thrust::copy_if(
-            zip(pImpl_->vertPos_.beginD(), countAt(0)),
-            zip(pImpl_->vertPos_.endD(), countAt(NumVert())),
+            zip(base.vertPos_.beginD(), countAt(0)),
+            zip(base.vertPos_.endD(), countAt(NumVert())),
             vertLabel.beginD(),
             zip(meshes[i].pImpl_->vertPos_.beginD(), vertNew2Old.beginD()),
             Equals({i})) -
@@ -454,15 +454,15 @@ std::vector<Manifold> Manifold::Decompose() const {
     int nFace =
         thrust::remove_if(
             faceNew2Old.beginD(), faceNew2Old.endD(),
-            RemoveFace({pImpl_->halfedge_.cptrD(), vertLabel.cptrD(), i})) -
+            RemoveFace({base.halfedge_.cptrD(), vertLabel.cptrD(), i})) -
         faceNew2Old.beginD();
     faceNew2Old.resize(nFace);
 
-    meshes[i].pImpl_->GatherFaces(*pImpl_, faceNew2Old);
-    meshes[i].pImpl_->ReindexVerts(vertNew2Old, pImpl_->NumVert());
+    meshes[i].pImpl_->GatherFaces(base, faceNew2Old);
+    meshes[i].pImpl_->ReindexVerts(vertNew2Old, base.NumVert());
 
     meshes[i].pImpl_->Finish();
-    meshes[i].pImpl_->transform_ = pImpl_->transform_;
+    meshes[i].transform_ = transform_;
   }
   return meshes;
 }
@@ -0,0 +1,336 @@
+// Copyright 2021 Emmett Lalish
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+
+#include "csg_tree.cuh"
+#include "thread_pool.cuh"
+
+namespace {
+using namespace manifold;
+
+bool IsEmpty(const Box& box) { return !box.isFinite(); }
+
+Box Intersection(const Box& a, const Box& b) {
+  Box out;
+  out.min = glm::max(a.min, b.min);
+  out.max = glm::min(a.max, b.max);
+  if (glm::any(glm::greaterThan(out.min, out.max))) return Box();
+  return out;
+}
+
+// Removes the children from begin on whose bounds satisfy the predicate.
+template <typename Pred>
+void RemoveIf(std::vector<Manifold>& children, std::vector<Box>& bounds,
+              int begin, Pred pred) {
+  int kept = begin;
+  for (int i = begin; i < children.size(); ++i) {
+    if (pred(bounds[i])) continue;
+    if (kept != i) {
+      children[kept] = std::move(children[i]);
+      bounds[kept] = bounds[i];
+    }
+    ++kept;
+  }
+  children.erase(children.begin() + kept, children.end());
+  bounds.erase(bounds.begin() + kept, bounds.end());
+}
+}  // namespace
+
+namespace manifold {
+
+/**
+ * Returns a deferred Boolean of the two operands. Chains of the same operation
+ * are flattened into a single n-ary node, as is P - (Q + R), which becomes
+ * P - Q - R. Operands that cannot affect the result according to their bounding
+ * boxes are pruned, including the terms of a union that lie outside of an
+ * intersection. Transforms of flattened nodes are pushed down to their
+ * children, so consecutive transforms are collapsed into one per leaf.
+ */
+Manifold Manifold::CsgNode::Create(OpType op, const Manifold& first,
+                                   const Manifold& second) {
+  // When first is an unevaluated node of the same op, its children are shared
+  // rather than copied, so a chain of n ops such as a += b is O(n), not O(n^2).
+  std::shared_ptr<Children> shared;
+  int numShared = 0;
+  Box bBox;
+  if (first.csg_ && first.csg_->op_ == op &&
+      first.transform_ == glm::mat4x3(1.0f)) {
+    CsgNode& node = *first.csg_;
+    std::lock_guard<std::mutex> lock(node.mutex_);
+    if (!node.result_) {
+      shared = node.children_;
+      numShared = node.numChildren_;
+      bBox = node.bBox_;
+    }
+  }
+
+  std::vector<Manifold> children;
+  std::vector<Box> bounds;
+  if (!shared) {
+    Flatten(children, bounds, first, op);
+    bBox = bounds[0];
+  }
+  Flatten(children, bounds, second, op == OpType::SUBTRACT ? OpType::ADD : op);
+
+  switch (op) {
+    case OpType::ADD:
+      RemoveIf(children, bounds, 0,
+               [](const Box& box) { return IsEmpty(box); });
+      for (const Box& box : bounds) bBox = bBox.Union(box);
+      break;
+    case OpType::SUBTRACT:
+      // bBox is that of the minuend, which is always kept.
+      RemoveIf(children, bounds, shared ? 0 : 1,
+               [&bBox](const Box& box) { return !box.DoesOverlap(bBox); });
+      break;
+    case OpType::INTERSECT:
+      // Shared children were already pruned to the previous region, which is
+      // enough, as pruning is only an optimization.
+      for (const Box& box : bounds) bBox = Intersection(bBox, box);
+      if (IsEmpty(bBox)) return Manifold();
+      for (int i = 0; i < children.size(); ++i) {
+        children[i] = Prune(children[i], bBox);
+        bounds[i] = GetBounds(children[i]);
+        if (IsEmpty(bounds[i])) return Manifold();
+      }
+      break;
+  }
+  if (!shared) return Make(op, std::move(children), std::move(bounds));
+
+  auto node = std::make_shared<CsgNode>();
+  node->op_ = op;
+  node->bBox_ = bBox;
+  node->numChildren_ = numShared + children.size();
+  {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    if (!children.empty() && shared->manifolds.size() != numShared) {
+      // Another node has already appended to this list, so copy the part this
+      // one shares.
+      auto copy = std::make_shared<Children>();
+      for (int i = 0; i < numShared; ++i) {
+        copy->manifolds.push_back(Alias(shared->manifolds[i]));
+      }
+      copy->bounds.assign(shared->bounds.begin(),
+                          shared->bounds.begin() + numShared);
+      shared = copy;
+    }
+    shared->manifolds.insert(shared->manifolds.end(),
+                             std::make_move_iterator(children.begin()),
+                             std::make_move_iterator(children.end()));
+    shared->bounds.insert(shared->bounds.end(), bounds.begin(), bounds.end());
+  }
+  node->children_ = shared;
+
+  Manifold out;
+  out.pImpl_.reset();
+  out.csg_ = node;
+  return out;
+}
+
+/**
+ * Evaluates this node, if it has not been already, and returns its result
+ * without the transforms of the Manifolds that reference it. The lock is not
+ * held during evaluation, which runs tasks on this thread that may need it for
+ * other nodes; a concurrent caller waits for the first one to finish instead.
+ */
+std::shared_ptr<Manifold::Impl> Manifold::CsgNode::GetResult() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  evaluated_.wait(lock, [this] { return !evaluating_; });
+  if (result_) return result_;
+  evaluating_ = true;
+  lock.unlock();
+
+  Manifold out;
+  try {
+    EvaluateChildren();
+    out = BatchBoolean(GetChildren(), op_);
+    out.GetImpl();
+  } catch (...) {
+    // Let a waiting caller retry, and likely rethrow, rather than hang.
+    lock.lock();
+    evaluating_ = false;
+    lock.unlock();
+    evaluated_.notify_all();
+    throw;
+  }
+
+  lock.lock();
+  result_ = out.pImpl_;
+  children_.reset();
+  evaluating_ = false;
+  lock.unlock();
+  evaluated_.notify_all();
+  return out.pImpl_;
+}
+
+/**
+ * Returns this node's children, copied under the lock of their list, as later
+ * nodes of the chain may be appending to it.
+ */
+std::vector<Manifold> Manifold::CsgNode::GetChildren() const {
+  std::lock_guard<std::mutex> lock(children_->mutex);
+  std::vector<Manifold> children;
+  children.reserve(numChildren_);
+  for (int i = 0; i < numChildren_; ++i) {
+    children.push_back(Alias(children_->manifolds[i]));
+  }
+  return children;
+}
+
+/**
+ * Evaluates the unevaluated nodes below this one, which form a DAG since
+ * subtrees may be shared. Each node's height is its distance above the leaves
+ * or evaluated nodes, so the nodes of a given height are independent of each
+ * other and are evaluated concurrently, in order of increasing height. Shared
+ * nodes are only evaluated once.
+ */
+void Manifold::CsgNode::EvaluateChildren() {
+  std::unordered_map<CsgNode*, int> heights;
+  std::vector<std::vector<std::shared_ptr<CsgNode>>> levels(1);
+  std::function<int(const std::vector<Manifold>&)> visit =
+      [&](const std::vector<Manifold>& children) {
+        int height = 0;
+        for (const Manifold& child : children) {
+          if (!child.csg_) continue;
+          CsgNode& node = *child.csg_;
+          auto it = heights.find(&node);
+          if (it == heights.end()) {
+            std::lock_guard<std::mutex> lock(node.mutex_);
+            const int nodeHeight =
+                node.result_ ? 0 : 1 + visit(node.GetChildren());
+            it = heights.emplace(&node, nodeHeight).first;
+            if (nodeHeight >= levels.size()) levels.resize(nodeHeight + 1);
+            levels[nodeHeight].push_back(child.csg_);
+          }
+          height = std::max(height, it->second);
+        }
+        return height;
+      };
+  visit(GetChildren());
+
+  for (int height = 1; height < levels.size(); ++height) {
+    const std::vector<std::shared_ptr<CsgNode>>& level = levels[height];
+    ParallelFor(level.size(), [&level](int i) { level[i]->GetResult(); });
+  }
+}
+
+Manifold Manifold::CsgNode::Make(OpType op, std::vector<Manifold> children,
+                                 std::vector<Box> bounds) {
+  if (children.empty()) return Manifold();
+  if (children.size() == 1) {
+    Manifold out = Alias(children[0]);
+    out.newMeshIDs_ = true;
+    return out;
+  }
+
+  auto node = std::make_shared<CsgNode>();
+  node->op_ = op;
+  node->bBox_ = bounds[0];
+  for (const Box& bBox : bounds) {
+    if (op == OpType::ADD) node->bBox_ = node->bBox_.Union(bBox);
+    if (op == OpType::INTERSECT) node->bBox_ = Intersection(node->bBox_, bBox);
+  }
+  node->numChildren_ = children.size();
+  node->children_ = std::make_shared<Children>();
+  node->children_->manifolds = std::move(children);
+  node->children_->bounds = std::move(bounds);
+
+  Manifold out;
+  out.pImpl_.reset();
+  out.csg_ = node;
+  return out;
+}
+
+/**
+ * Appends the operand to children, or if it is an unevaluated node of the
+ * given op, its children instead, with the operand's transform applied. Their
+ * bounds are appended to bounds, reusing the node's when the transform is the
+ * identity.
+ */
+void Manifold::CsgNode::Flatten(std::vector<Manifold>& children,
+                                std::vector<Box>& bounds,
+                                const Manifold& operand, OpType op) {
+  if (operand.csg_ && operand.csg_->op_ == op) {
+    CsgNode& node = *operand.csg_;
+    std::lock_guard<std::mutex> lock(node.mutex_);
+    if (!node.result_) {
+      const bool identity = operand.transform_ == glm::mat4x3(1.0f);
+      std::lock_guard<std::mutex> listLock(node.children_->mutex);
+      for (int i = 0; i < node.numChildren_; ++i) {
+        children.push_back(Alias(node.children_->manifolds[i]));
+        if (identity) {
+          bounds.push_back(node.children_->bounds[i]);
+        } else {
+          children.back().Transform(operand.transform_);
+          bounds.push_back(GetBounds(children.back()));
+        }
+      }
+      return;
+    }
+  }
+  children.push_back(Alias(operand));
+  bounds.push_back(GetBounds(operand));
+}
+
+/**
+ * Returns the operand with the terms of its union removed that do not overlap
+ * the region, as they do not matter to an intersection with it.
+ */
+Manifold Manifold::CsgNode::Prune(const Manifold& operand, const Box& region) {
+  if (!operand.csg_ || operand.csg_->op_ != OpType::ADD) return Alias(operand);
+  std::vector<Manifold> terms;
+  std::vector<Box> bounds;
+  Flatten(terms, bounds, operand, OpType::ADD);
+  const int numTerms = terms.size();
+  RemoveIf(terms, bounds, 0,
+           [&region](const Box& box) { return !box.DoesOverlap(region); });
+  if (terms.size() == numTerms) return Alias(operand);
+  return Make(OpType::ADD, std::move(terms), std::move(bounds));
+}
+
+/**
+ * Returns a shallow copy that does not get new mesh IDs unless the original
+ * would have, as CSG operands are not user-visible copies.
+ */
+Manifold Manifold::CsgNode::Alias(const Manifold& manifold) {
+  Manifold out;
+  out.pImpl_ = manifold.pImpl_;
+  out.csg_ = manifold.csg_;
+  out.transform_ = manifold.transform_;
+  out.newMeshIDs_ = manifold.newMeshIDs_;
+  return out;
+}
+
+/**
+ * Returns a box bounding the manifold without evaluating it. Unlike
+ * Box::Transform(), this is valid for any transform.
+ */
+Box Manifold::CsgNode::GetBounds(const Manifold& manifold) {
+  const Box bBox =
+      manifold.csg_ ? manifold.csg_->bBox_ : manifold.pImpl_->bBox_;
+  if (IsEmpty(bBox)) return Box();
+  Box out;
+  for (int i = 0; i < 8; ++i) {
+    const glm::vec3 corner(i & 1 ? bBox.max.x : bBox.min.x,
+                           i & 2 ? bBox.max.y : bBox.min.y,
+                           i & 4 ? bBox.max.z : bBox.min.z);
+    out.Union(manifold.transform_ * glm::vec4(corner, 1.0f));
+  }
+  return out;
+}
+}  // namespace manifold
@@ -0,0 +1,73 @@
+// Copyright 2021 Emmett Lalish
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include <condition_variable>
+#include <mutex>
+
+#include "impl.cuh"
+
+namespace manifold {
+
+/** @ingroup Private */
+/**
+ * A deferred n-ary Boolean operation, built by the Boolean operators when
+ * SetLazyBoolean(true) is in effect. For SUBTRACT, all children after the first
+ * are subtracted from it. The children are Manifolds themselves, so they may be
+ * further CsgNodes, and their transforms are still pending. The node is
+ * evaluated with BatchBoolean() the first time its result is needed, after
+ * which the children are released. The nodes below it are evaluated first as a
+ * task graph, running independent subtrees concurrently.
+ */
+struct Manifold::CsgNode {
+  OpType op_;
+  // Conservative bounds of the result, in the frame of the children.
+  Box bBox_;
+  std::shared_ptr<Impl> result_;
+  std::mutex mutex_;
+  // Set while a thread evaluates this node without holding mutex_; other
+  // threads that need the result wait on evaluated_.
+  bool evaluating_ = false;
+  std::condition_variable evaluated_;
+
+  static Manifold Create(OpType op, const Manifold& first,
+                         const Manifold& second);
+  std::shared_ptr<Impl> GetResult();
+
+ private:
+  /**
+   * The children of a chain of nodes of the same op, with their bounds. Each
+   * node of the chain uses the first numChildren_ entries, so a node built by
+   * one more op appends its operand in place rather than copying the others.
+   * Entries are never modified once appended.
+   */
+  struct Children {
+    std::mutex mutex;
+    std::vector<Manifold> manifolds;
+    std::vector<Box> bounds;
+  };
+  std::shared_ptr<Children> children_;
+  int numChildren_ = 0;
+
+  std::vector<Manifold> GetChildren() const;
+  void EvaluateChildren();
+  static Manifold Make(OpType op, std::vector<Manifold> children,
+                       std::vector<Box> bounds);
+  static void Flatten(std::vector<Manifold>& children, std::vector<Box>& bounds,
+                      const Manifold& operand, OpType op);
+  static Manifold Prune(const Manifold& operand, const Box& region);
+  static Manifold Alias(const Manifold& manifold);
+  static Box GetBounds(const Manifold& manifold);
+};
+}  // namespace manifold
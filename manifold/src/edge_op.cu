@@ -12,7 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <climits>
+
 #include "impl.cuh"
+#include "thread_pool.cuh"
 
 namespace {
 using namespace manifold;
@@ -99,6 +102,87 @@ struct SwappableEdge {
            Is01Longest(v[0], v[1], v[2]);
   }
 };
+
+struct Removed {
+  const Halfedge* halfedge;
+
+  __host__ __device__ bool operator()(int edge) {
+    return halfedge[edge].pairedHalfedge < 0;
+  }
+};
+
+enum class Collapse { WAIT, CONCURRENT, SERIAL };
+
+constexpr int kNoOwner = INT_MAX;
+
+struct IsCollapse {
+  const Collapse collapse;
+
+  __host__ __device__ bool operator()(Collapse in) { return in == collapse; }
+};
+
+// The verts a collapse of edge reads or writes: both of its verts and all of
+// their neighbors, i.e. the closed one-rings of its two verts.
+struct ClaimVerts {
+  int* owner;
+  const Halfedge* halfedge;
+
+  __host__ __device__ void operator()(thrust::tuple<int, int> in) {
+    const int edge = thrust::get<0>(in);
+    const int claim = thrust::get<1>(in);
+
+    for (const int start : {edge, halfedge[edge].pairedHalfedge}) {
+      AtomicMin(owner[halfedge[start].startVert], claim);
+      int current = start;
+      do {
+        AtomicMin(owner[halfedge[current].endVert], claim);
+        current = NextHalfedge(halfedge[current].pairedHalfedge);
+      } while (current != start);
+    }
+  }
+};
+
+// Returns true if CollapseEdge would call FormLoop on this edge, which happens
+// when its two verts share a neighbor besides the two opposite verts. This
+// follows the same orbits as CollapseEdge.
+__host__ __device__ bool FormsLoop(const Halfedge* halfedge, int edge) {
+  const glm::ivec3 tri0edge = TriOf(edge);
+  const glm::ivec3 tri1edge = TriOf(halfedge[edge].pairedHalfedge);
+
+  int current = halfedge[tri1edge[1]].pairedHalfedge;
+  while (current != tri0edge[2]) {
+    current = NextHalfedge(current);
+    const int vert = halfedge[current].endVert;
+    int other = halfedge[tri0edge[1]].pairedHalfedge;
+    while (other != tri1edge[2]) {
+      other = NextHalfedge(other);
+      if (halfedge[other].endVert == vert) return true;
+      other = halfedge[other].pairedHalfedge;
+    }
+    current = halfedge[current].pairedHalfedge;
+  }
+  return false;
+}
+
+struct SelectEdge {
+  const int* owner;
+  const Halfedge* halfedge;
+
+  __host__ __device__ Collapse operator()(thrust::tuple<int, int> in) {
+    const int edge = thrust::get<0>(in);
+    const int claim = thrust::get<1>(in);
+
+    for (const int start : {edge, halfedge[edge].pairedHalfedge}) {
+      if (owner[halfedge[start].startVert] != claim) return Collapse::WAIT;
+      int current = start;
+      do {
+        if (owner[halfedge[current].endVert] != claim) return Collapse::WAIT;
+        current = NextHalfedge(halfedge[current].pairedHalfedge);
+      } while (current != start);
+    }
+    return FormsLoop(halfedge, edge) ? Collapse::SERIAL : Collapse::CONCURRENT;
+  }
+};
 }  // namespace
 
 namespace manifold {
@@ -111,6 +195,9 @@ namespace manifold {
  *
  * Rather than actually removing the edges, this step merely marks them for
  * removal, by setting vertPos to NaN and halfedge to {-1, -1, -1, -1}.
+ *
+ * The collapses run concurrently (see CollapseEdges), but the swaps remain
+ * serial, since each one may recurse an unbounded distance across the mesh.
  */
 void Manifold::Impl::CollapseDegenerates() {
   VecDH<int> flaggedEdges(halfedge_.size());
@@ -121,7 +208,7 @@ void Manifold::Impl::CollapseDegenerates() {
       flaggedEdges.beginD();
   flaggedEdges.resize(numFlagged);
 
-  for (const int edge : flaggedEdges.H()) CollapseEdge(edge);
+  CollapseEdges(flaggedEdges);
 
   flaggedEdges.resize(halfedge_.size());
   numFlagged =
@@ -131,7 +218,7 @@ void Manifold::Impl::CollapseDegenerates() {
       flaggedEdges.beginD();
   flaggedEdges.resize(numFlagged);
 
-  for (const int edge : flaggedEdges.H()) CollapseEdge(edge);
+  CollapseEdges(flaggedEdges);
 
   flaggedEdges.resize(halfedge_.size());
   numFlagged = thrust::copy_if(
@@ -146,6 +233,79 @@ void Manifold::Impl::CollapseDegenerates() {
   }
 }
 
+// Below this, a round costs more than it saves, and a chain of edges that each
+// conflict with the next would take a round per edge.
+std::atomic<int> Manifold::Impl::minConcurrentCollapses_(64);
+
+/**
+ * Collapses the given edges, which must be in ascending order, by calling
+ * CollapseEdge on each. This proceeds in rounds: each remaining edge claims the
+ * closed one-rings of its two verts, lower edges taking precedence, and those
+ * that win all of their claims form an independent set. Their collapses touch
+ * disjoint triangles, so they commute and run concurrently. Edges that overlap
+ * collapse in ascending order, as in a serial loop, though an edge may collapse
+ * before a lower one whose one-ring only reaches it later, so the result is not
+ * guaranteed to match that loop. The lowest remaining edge always wins, so
+ * every round makes progress. Collapses that would call FormLoop add verts, so
+ * those run serially at the end of their round. Once a round would collapse
+ * fewer than minConcurrentCollapses_ edges, the rest are collapsed serially.
+ */
+void Manifold::Impl::CollapseEdges(VecDH<int>& edges) {
+  VecDH<int> owner;
+  VecDH<Collapse> collapse;
+  VecDH<int> concurrent;
+  VecDH<int> serial;
+  VecDH<int> waiting;
+
+  auto Select = [&edges, &collapse](VecDH<int>& out, Collapse which) {
+    out.resize(edges.size());
+    out.resize(thrust::copy_if(poolPolicy(), edges.beginD(), edges.endD(),
+                               collapse.beginD(), out.beginD(),
+                               IsCollapse({which})) -
+               out.beginD());
+  };
+
+  int numCollapsed = INT_MAX;
+  for (;;) {
+    edges.resize(thrust::remove_if(poolPolicy(), edges.beginD(), edges.endD(),
+                                   Removed({halfedge_.cptrD()})) -
+                 edges.beginD());
+    const int numEdge = edges.size();
+    if (numEdge == 0) break;
+    if (glm::min(numEdge, numCollapsed) < minConcurrentCollapses_) {
+      for (const int edge : edges.H()) CollapseEdge(edge);
+      break;
+    }
+
+    // Including the new verts from FormLoop.
+    owner.resize(NumVert());
+    thrust::fill(owner.beginD(), owner.endD(), kNoOwner);
+    thrust::for_each_n(zip(edges.beginD(), countAt(0)), numEdge,
+                       ClaimVerts({owner.ptrD(), halfedge_.cptrD()}));
+    collapse.resize(numEdge);
+    thrust::transform(zip(edges.beginD(), countAt(0)),
+                      zip(edges.endD(), countAt(numEdge)), collapse.beginD(),
+                      SelectEdge({owner.cptrD(), halfedge_.cptrD()}));
+
+    Select(concurrent, Collapse::CONCURRENT);
+    Select(serial, Collapse::SERIAL);
+    Select(waiting, Collapse::WAIT);
+    edges.swap(waiting);
+    numCollapsed = concurrent.size() + serial.size();
+
+    // Sync the host copies before the threads take references to them.
+    halfedge_.H();
+    vertPos_.H();
+    faceNormal_.H();
+    meshRelation_.triBary.H();
+    const VecH<int>& concurrentH = concurrent.H();
+    ParallelFor(concurrentH.size(),
+                [this, &concurrentH](int i) { CollapseEdge(concurrentH[i]); });
+
+    for (const int edge : serial.H()) CollapseEdge(edge);
+  }
+}
+
 void Manifold::Impl::PairUp(int edge0, int edge1) {
   VecH<Halfedge>& halfedge = halfedge_.H();
   halfedge[edge0].pairedHalfedge = edge1;
@@ -12,48 +12,87 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <thrust/logical.h>
+
+#include <algorithm>
+#include <climits>
 #include <map>
 
 #include "impl.cuh"
 #include "polygon.h"
+#include "thread_pool.cuh"
 
-namespace manifold {
+namespace {
+using namespace manifold;
 
-/**
- * Triangulates the faces. In this case, the halfedge_ vector is not yet a set
- * of triangles as required by this data structure, but is instead a set of
- * general faces with the input faceEdge vector having length of the number of
- * faces + 1. The values are indicies into the halfedge_ vector for the first
- * edge of each face, with the final value being the length of the halfedge_
- * vector itself. Upon return, halfedge_ has been lengthened and properly
- * represents the mesh as a set of triangles as usual. In this process the
- * faceNormal_ values are retained, repeated as necessary.
- */
-void Manifold::Impl::Face2Tri(const VecDH<int>& faceEdge,
-                              const VecDH<BaryRef>& faceRef,
-                              const VecDH<int>& halfedgeBary) {
-  VecDH<glm::ivec3> triVertsOut;
-  VecDH<glm::vec3> triNormalOut;
+__host__ __device__ int NumEdge(const int* faceEdge, int face) {
+  return faceEdge[face + 1] - faceEdge[face];
+}
 
-  VecH<glm::ivec3>& triVerts = triVertsOut.H();
-  VecH<glm::vec3>& triNormal = triNormalOut.H();
-  const VecH<glm::vec3>& vertPos = vertPos_.H();
-  const VecH<int>& faceEdgeH = faceEdge.H();
-  const VecH<Halfedge>& halfedge = halfedge_.H();
-  const VecH<glm::vec3>& faceNormal = faceNormal_.H();
-  meshRelation_.triBary.resize(0);
+// Triangles and quads are split on the device; larger faces are general.
+struct IsGeneral {
+  const int* faceEdge;
 
-  for (int face = 0; face < faceEdgeH.size() - 1; ++face) {
-    const int firstEdge = faceEdgeH[face];
-    const int lastEdge = faceEdgeH[face + 1];
+  __host__ __device__ bool operator()(int face) {
+    return NumEdge(faceEdge, face) > 4;
+  }
+};
+
+struct AtLeastTriangle {
+  const int* faceEdge;
+
+  __host__ __device__ bool operator()(int face) {
+    return NumEdge(faceEdge, face) >= 3;
+  }
+};
+
+struct CountTris {
+  const int* faceEdge;
+
+  __host__ __device__ int operator()(int face) {
+    const int numEdge = NumEdge(faceEdge, face);
+    return numEdge == 3 ? 1 : numEdge == 4 ? 2 : 0;
+  }
+};
+
+// Returns the barycentric index of vert, which must be the startVert of one of
+// the halfedges in [firstEdge, lastEdge).
+__host__ __device__ int VertBary(int vert, const Halfedge* halfedge,
+                                 const int* halfedgeBary, int firstEdge,
+                                 int lastEdge) {
+  for (int j = firstEdge; j < lastEdge; ++j) {
+    if (halfedge[j].startVert == vert) return halfedgeBary[j];
+  }
+  return 0;
+}
+
+struct SplitSmallFace {
+  glm::ivec3* triVerts;
+  glm::vec3* triNormal;
+  BaryRef* triBary;
+  const int* faceEdge;
+  const int* triOffset;
+  const Halfedge* halfedge;
+  const int* halfedgeBary;
+  const glm::vec3* vertPos;
+  const glm::vec3* faceNormal;
+  const BaryRef* faceRef;
+  const float precision;
+
+  __host__ __device__ bool TriCCW(const glm::mat3x2& projection,
+                                  glm::ivec3 tri) {
+    return CCW(projection * vertPos[tri[0]], projection * vertPos[tri[1]],
+               projection * vertPos[tri[2]], precision) >= 0;
+  }
+
+  __host__ __device__ void operator()(int face) {
+    const int firstEdge = faceEdge[face];
+    const int lastEdge = faceEdge[face + 1];
     const int numEdge = lastEdge - firstEdge;
-    ALWAYS_ASSERT(numEdge >= 3, topologyErr, "face has less than three edges.");
+    if (numEdge != 3 && numEdge != 4) return;
+    const int firstTri = triOffset[face];
     const glm::vec3 normal = faceNormal[face];
-
-    std::map<int, int> vertBary;
-    for (int j = firstEdge; j < lastEdge; ++j)
-      vertBary[halfedge[j].startVert] = halfedgeBary.H()[j];
-    const int startTri = triVerts.size();
+    glm::ivec3 tris[2];
 
     if (numEdge == 3) {  // Single triangle
       glm::ivec3 tri(halfedge[firstEdge].startVert,
@@ -63,21 +102,16 @@ void Manifold::Impl::Face2Tri(const VecDH<int>& faceEdge,
                       halfedge[firstEdge + 1].endVert,
                       halfedge[firstEdge + 2].endVert);
       if (ends[0] == tri[2]) {
-        std::swap(tri[1], tri[2]);
-        std::swap(ends[1], ends[2]);
+        thrust::swap(tri[1], tri[2]);
+        thrust::swap(ends[1], ends[2]);
       }
-      ALWAYS_ASSERT(ends[0] == tri[1] && ends[1] == tri[2] && ends[2] == tri[0],
-                    topologyErr, "These 3 edges do not form a triangle!");
-
-      triVerts.push_back(tri);
-      triNormal.push_back(normal);
-    } else if (numEdge == 4) {  // Pair of triangles
-      const glm::mat3x2 projection = GetAxisAlignedProjection(normal);
-      auto triCCW = [&projection, &vertPos, this](const glm::ivec3 tri) {
-        return CCW(projection * vertPos[tri[0]], projection * vertPos[tri[1]],
-                   projection * vertPos[tri[2]], precision_) >= 0;
-      };
-
+      // Marks the face as invalid, for CheckTris.
+      if (ends[0] != tri[1] || ends[1] != tri[2] || ends[2] != tri[0]) {
+        triVerts[firstTri] = glm::ivec3(-1);
+        return;
+      }
+      tris[0] = tri;
+    } else {  // Pair of triangles
       glm::ivec3 tri0(halfedge[firstEdge].startVert,
                       halfedge[firstEdge].endVert, -1);
       glm::ivec3 tri1(-1, -1, tri0[0]);
@@ -90,13 +124,16 @@ void Manifold::Impl::Face2Tri(const VecDH<int>& faceEdge,
           tri1[1] = halfedge[firstEdge + i].startVert;
         }
       }
-      ALWAYS_ASSERT(glm::all(glm::greaterThanEqual(tri0, glm::ivec3(0))) &&
-                        glm::all(glm::greaterThanEqual(tri1, glm::ivec3(0))),
-                    topologyErr, "non-manifold quad!");
-      bool firstValid = triCCW(tri0) && triCCW(tri1);
+      if (!glm::all(glm::greaterThanEqual(tri0, glm::ivec3(0))) ||
+          !glm::all(glm::greaterThanEqual(tri1, glm::ivec3(0)))) {
+        triVerts[firstTri] = glm::ivec3(-1);
+        return;
+      }
+      const glm::mat3x2 projection = GetAxisAlignedProjection(normal);
+      bool firstValid = TriCCW(projection, tri0) && TriCCW(projection, tri1);
       tri0[2] = tri1[1];
       tri1[2] = tri0[1];
-      bool secondValid = triCCW(tri0) && triCCW(tri1);
+      bool secondValid = TriCCW(projection, tri0) && TriCCW(projection, tri1);
 
       if (!secondValid) {
         tri0[2] = tri1[0];
@@ -110,41 +147,165 @@ void Manifold::Impl::Face2Tri(const VecDH<int>& faceEdge,
           tri1[2] = tri0[0];
         }
       }
+      tris[0] = tri0;
+      tris[1] = tri1;
+    }
 
-      triVerts.push_back(tri0);
-      triNormal.push_back(normal);
-      triVerts.push_back(tri1);
-      triNormal.push_back(normal);
-    } else {  // General triangulation
-      const glm::mat3x2 projection = GetAxisAlignedProjection(normal);
-
-      Polygons polys;
-      try {
-        polys = Face2Polygons(face, projection, faceEdgeH);
-      } catch (const std::exception& e) {
-        std::cout << e.what() << std::endl;
-        for (int edge = faceEdgeH[face]; edge < faceEdgeH[face + 1]; ++edge)
-          std::cout << "halfedge: " << edge << ", " << halfedge[edge]
-                    << std::endl;
-        throw;
+    for (int i = 0; i < numEdge - 2; ++i) {
+      triVerts[firstTri + i] = tris[i];
+      triNormal[firstTri + i] = normal;
+      BaryRef ref = faceRef[face];
+      for (const int k : {0, 1, 2}) {
+        ref.vertBary[k] =
+            VertBary(tris[i][k], halfedge, halfedgeBary, firstEdge, lastEdge);
       }
+      triBary[firstTri + i] = ref;
+    }
+  }
+};
 
-      std::vector<glm::ivec3> newTris = Triangulate(polys, precision_);
+struct CheckTris {
+  const int numEdge;
+  const int* faceEdge;
+  const int* triOffset;
+  const glm::ivec3* triVerts;
 
-      for (auto tri : newTris) {
-        triVerts.push_back(tri);
-        triNormal.push_back(normal);
-      }
+  __host__ __device__ bool operator()(int face) {
+    return NumEdge(faceEdge, face) != numEdge ||
+           triVerts[triOffset[face]][0] >= 0;
+  }
+};
+}  // namespace
+
+namespace manifold {
+
+/**
+ * Triangulates the faces. In this case, the halfedge_ vector is not yet a set
+ * of triangles as required by this data structure, but is instead a set of
+ * general faces with the input faceEdge vector having length of the number of
+ * faces + 1. The values are indicies into the halfedge_ vector for the first
+ * edge of each face, with the final value being the length of the halfedge_
+ * vector itself. Upon return, halfedge_ has been lengthened and properly
+ * represents the mesh as a set of triangles as usual. In this process the
+ * faceNormal_ values are retained, repeated as necessary.
+ *
+ * The faces are independent, so the triangles of each face are counted first,
+ * then scanned to give each face its own slot. Triangles and quads are split
+ * in parallel on the device, while larger faces are triangulated concurrently
+ * on the ThreadPool.
+ */
+void Manifold::Impl::Face2Tri(const VecDH<int>& faceEdge,
+                              const VecDH<BaryRef>& faceRef,
+                              const VecDH<int>& halfedgeBary) {
+  const int numFace = faceEdge.size() - 1;
+  ALWAYS_ASSERT(thrust::all_of(poolPolicy(), countAt(0), countAt(numFace),
+                               AtLeastTriangle({faceEdge.cptrD()})),
+                topologyErr, "face has less than three edges.");
+
+  VecDH<int> generalFace(numFace);
+  generalFace.resize(thrust::copy_if(poolPolicy(), countAt(0),
+                                     countAt(numFace), generalFace.beginD(),
+                                     IsGeneral({faceEdge.cptrD()})) -
+                     generalFace.beginD());
+  const int numGeneral = generalFace.size();
+
+  // Sync the host copies before the threads read them.
+  const VecH<int>& generalFaceH = generalFace.H();
+  const VecH<int>& faceEdgeH = faceEdge.H();
+  const VecH<Halfedge>& halfedge = halfedge_.H();
+  const VecH<glm::vec3>& faceNormal = faceNormal_.H();
+  const VecH<int>& halfedgeBaryH = halfedgeBary.H();
+  const VecH<BaryRef>& faceRefH = faceRef.H();
+  vertPos_.H();
+
+  std::vector<std::vector<glm::ivec3>> generalTris(numGeneral);
+  ParallelFor(numGeneral, [&](int i) {
+    const int face = generalFaceH[i];
+    const glm::mat3x2 projection = GetAxisAlignedProjection(faceNormal[face]);
+
+    Polygons polys;
+    try {
+      polys = Face2Polygons(face, projection, faceEdgeH);
+    } catch (const std::exception& e) {
+      std::cout << e.what() << std::endl;
+      for (int edge = faceEdgeH[face]; edge < faceEdgeH[face + 1]; ++edge)
+        std::cout << "halfedge: " << edge << ", " << halfedge[edge]
+                  << std::endl;
+      throw;
     }
 
-    for (int tri = startTri; tri < triVerts.size(); ++tri) {
-      meshRelation_.triBary.H().push_back(faceRef.H()[face]);
-      for (int k : {0, 1, 2}) {
-        meshRelation_.triBary.H().back().vertBary[k] =
-            vertBary[triVerts[tri][k]];
+    generalTris[i] = Triangulate(polys, precision_);
+  });
+
+  VecDH<int> triCount(numFace);
+  thrust::transform(countAt(0), countAt(numFace), triCount.beginD(),
+                    CountTris({faceEdge.cptrD()}));
+  VecDH<int> generalCount(numGeneral);
+  VecH<int>& generalCountH = generalCount.H();
+  for (int i = 0; i < numGeneral; ++i) {
+    generalCountH[i] = generalTris[i].size();
+  }
+  thrust::scatter(generalCount.beginD(), generalCount.endD(),
+                  generalFace.beginD(), triCount.beginD());
+
+  VecDH<int> triOffset(numFace);
+  thrust::exclusive_scan(poolPolicy(), triCount.beginD(), triCount.endD(),
+                         triOffset.beginD());
+  const int numTri =
+      numFace == 0 ? 0 : triOffset.H().back() + triCount.H().back();
+
+  VecDH<glm::ivec3> triVertsOut(numTri);
+  VecDH<glm::vec3> triNormalOut(numTri);
+  meshRelation_.triBary.resize(numTri);
+
+  thrust::for_each_n(
+      countAt(0), numFace,
+      SplitSmallFace({triVertsOut.ptrD(), triNormalOut.ptrD(),
+                      meshRelation_.triBary.ptrD(), faceEdge.cptrD(),
+                      triOffset.cptrD(), halfedge_.cptrD(),
+                      halfedgeBary.cptrD(), vertPos_.cptrD(),
+                      faceNormal_.cptrD(), faceRef.cptrD(), precision_}));
+  ALWAYS_ASSERT(
+      thrust::all_of(poolPolicy(), countAt(0), countAt(numFace),
+                     CheckTris({3, faceEdge.cptrD(), triOffset.cptrD(),
+                                triVertsOut.cptrD()})),
+      topologyErr, "These 3 edges do not form a triangle!");
+  ALWAYS_ASSERT(
+      thrust::all_of(poolPolicy(), countAt(0), countAt(numFace),
+                     CheckTris({4, faceEdge.cptrD(), triOffset.cptrD(),
+                                triVertsOut.cptrD()})),
+      topologyErr, "non-manifold quad!");
+
+  glm::ivec3* triVerts = triVertsOut.ptrH();
+  glm::vec3* triNormal = triNormalOut.ptrH();
+  BaryRef* triBary = meshRelation_.triBary.ptrH();
+  const VecH<int>& triOffsetH = triOffset.H();
+  ParallelFor(numGeneral, [&](int i) {
+    const int face = generalFaceH[i];
+    const int firstEdge = faceEdgeH[face];
+    const int lastEdge = faceEdgeH[face + 1];
+
+    std::vector<std::pair<int, int>> vertBary;
+    for (int j = firstEdge; j < lastEdge; ++j)
+      vertBary.push_back({halfedge[j].startVert, halfedgeBaryH[j]});
+    std::sort(vertBary.begin(), vertBary.end());
+
+    int tri = triOffsetH[face];
+    for (const glm::ivec3& verts : generalTris[i]) {
+      triVerts[tri] = verts;
+      triNormal[tri] = faceNormal[face];
+      triBary[tri] = faceRefH[face];
+      for (const int k : {0, 1, 2}) {
+        const auto it =
+            std::lower_bound(vertBary.begin(), vertBary.end(),
+                             std::make_pair(verts[k], INT_MIN));
+        triBary[tri].vertBary[k] =
+            it != vertBary.end() && it->first == verts[k] ? it->second : 0;
       }
+      ++tri;
     }
-  }
+  });
+
   faceNormal_ = triNormalOut;
   CreateAndFixHalfedges(triVertsOut);
 }
@@ -14,11 +14,10 @@
 
 #include <thrust/execution_policy.h>
 #include <thrust/logical.h>
+#include <thrust/sequence.h>
+#include <thrust/sort.h>
 
 #include <algorithm>
-#include <boost/config.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/connected_components.hpp>
 #include <map>
 
 #include "impl.cuh"
@@ -28,14 +27,7 @@ using namespace manifold;
 
 __host__ __device__ void AtomicAddVec3(glm::vec3& target,
                                        const glm::vec3& add) {
-  for (int i : {0, 1, 2}) {
-#ifdef __CUDA_ARCH__
-    atomicAdd(&target[i], add[i]);
-#else
-#pragma omp atomic
-    target[i] += add[i];
-#endif
-  }
+  for (int i : {0, 1, 2}) AtomicAdd(target[i], add[i]);
 }
 
 struct Normalize {
@@ -99,6 +91,26 @@ struct AssignNormals {
   }
 };
 
+struct ReindexLeaf {
+  const int* leaf2Face;
+
+  __host__ __device__ void operator()(int& leaf) { leaf = leaf2Face[leaf]; }
+};
+
+// Sorts the q of each row of p, from the row's first entry.
+struct SortRow {
+  const int* p;
+  int* q;
+  const int size;
+
+  __host__ __device__ void operator()(int start) {
+    if (start > 0 && p[start - 1] == p[start]) return;
+    int end = start + 1;
+    while (end < size && p[end] == p[start]) ++end;
+    thrust::sort(thrust::seq, q + start, q + end);
+  }
+};
+
 struct Tri2Halfedges {
   Halfedge* halfedges;
   TmpEdge* edges;
@@ -273,13 +285,12 @@ struct CoplanarEdge {
   }
 };
 
-struct EdgeBox {
-  const glm::vec3* vertPos;
+struct LinkFaces {
+  int* parent;
 
-  __host__ __device__ void operator()(
-      thrust::tuple<Box&, const TmpEdge&> inout) {
-    const TmpEdge& edge = thrust::get<1>(inout);
-    thrust::get<0>(inout) = Box(vertPos[edge.first], vertPos[edge.second]);
+  __host__ __device__ void operator()(thrust::pair<int, int> face2face) {
+    if (face2face.first < 0) return;
+    UnionRoots(parent, face2face.first, face2face.second);
   }
 };
 }  // namespace
@@ -287,6 +298,7 @@ struct EdgeBox {
 namespace manifold {
 
 std::vector<int> Manifold::Impl::meshID2Original_;
+std::mutex Manifold::Impl::meshIDMutex_;
 
 /**
  * Create a manifold from an input triangle Mesh. Will throw if the Mesh is not
@@ -366,6 +378,7 @@ Manifold::Impl::Impl(Shape shape) {
  */
 void Manifold::Impl::DuplicateMeshIDs() {
   std::map<int, int> old2new;
+  std::lock_guard<std::mutex> lock(meshIDMutex_);
   for (BaryRef& ref : meshRelation_.triBary) {
     if (old2new.find(ref.meshID) == old2new.end()) {
       old2new[ref.meshID] = meshID2Original_.size();
@@ -385,8 +398,12 @@ int Manifold::Impl::InitializeNewReference(
     const std::vector<float>& properties,
     const std::vector<float>& propertyTolerance) {
   meshRelation_.triBary.resize(NumTri());
-  const int nextMeshID = meshID2Original_.size();
-  meshID2Original_.push_back(nextMeshID);
+  int nextMeshID;
+  {
+    std::lock_guard<std::mutex> lock(meshIDMutex_);
+    nextMeshID = meshID2Original_.size();
+    meshID2Original_.push_back(nextMeshID);
+  }
   ReinitializeReference(nextMeshID);
 
   const int numProps = propertyTolerance.size();
@@ -418,16 +435,12 @@ int Manifold::Impl::InitializeNewReference(
                     triPropertiesD.cptrD(), propertiesD.cptrD(),
                     propertyToleranceD.cptrD(), numProps, precision_}));
 
-  boost::adjacency_list<boost::vecS, boost::vecS, boost::undirectedS> graph(
-      NumTri());
-  for (int i = 0; i < face2face.size(); ++i) {
-    const thrust::pair<int, int> edge = face2face.H()[i];
-    if (edge.first < 0) continue;
-    boost::add_edge(edge.first, edge.second, graph);
-  }
-  std::vector<int> components(NumTri());
-  const int numComponent =
-      boost::connected_components(graph, components.data());
+  VecDH<int> componentsD(NumTri());
+  thrust::sequence(componentsD.beginD(), componentsD.endD());
+  thrust::for_each(face2face.beginD(), face2face.endD(),
+                   LinkFaces({componentsD.ptrD()}));
+  const int numComponent = LabelComponents(componentsD);
+  const VecH<int>& components = componentsD.H();
 
   std::vector<int> comp2tri(numComponent, -1);
   for (int tri = 0; tri < NumTri(); ++tri) {
@@ -531,46 +544,57 @@ void Manifold::Impl::CreateAndFixHalfedges(const VecDH<glm::ivec3>& triVerts) {
 void Manifold::Impl::Update() {
   CalculateBBox();
   VecDH<Box> faceBox;
-  VecDH<uint32_t> faceMorton;
-  GetFaceBoxMorton(faceBox, faceMorton);
+  GetFaceBox(faceBox);
   collider_.UpdateBoxes(faceBox);
-}
-
-void Manifold::Impl::ApplyTransform() const {
-  // This const_cast is here because these operations cancel out, leaving the
-  // state conceptually unchanged. This enables lazy transformation evaluation.
-  const_cast<Impl*>(this)->ApplyTransform();
+  edgeBVH_.Store(nullptr);
+  faceXYBVH_.Store(nullptr);
 }
 
 /**
- * Bake the manifold's transform into its vertices. This function allows lazy
- * evaluation, which is important because often several transforms are applied
- * between operations.
+ * Bake the manifold's transform into its vertices. The Manifold keeps its
+ * transform separately and calls this lazily, which is important because often
+ * several transforms are applied between operations.
  */
-void Manifold::Impl::ApplyTransform() {
-  if (transform_ == glm::mat4x3(1.0f)) return;
+void Manifold::Impl::ApplyTransform(const glm::mat4x3& transform) {
+  if (transform == glm::mat4x3(1.0f)) return;
   thrust::for_each(vertPos_.beginD(), vertPos_.endD(),
-                   Transform4x3({transform_}));
+                   Transform4x3({transform}));
 
   glm::mat3 normalTransform =
-      glm::inverse(glm::transpose(glm::mat3(transform_)));
+      glm::inverse(glm::transpose(glm::mat3(transform)));
   thrust::for_each(faceNormal_.beginD(), faceNormal_.endD(),
                    TransformNormals({normalTransform}));
   thrust::for_each(vertNormal_.beginD(), vertNormal_.endD(),
                    TransformNormals({normalTransform}));
-  // This optimization does a cheap collider update if the transform is
-  // axis-aligned.
-  if (!collider_.Transform(transform_)) Update();
+  // The collider absorbs any invertible transform without refitting its boxes,
+  // and likewise for a cached edge BVH.
+  if (collider_.Transform(transform)) {
+    const std::shared_ptr<const EdgeBVH> edgeBVH = edgeBVH_.Load();
+    if (edgeBVH) {
+      auto transformed = std::make_shared<EdgeBVH>(*edgeBVH);
+      transformed->collider.Transform(transform);
+      edgeBVH_.Store(transformed);
+    }
+    // The XY BVH is only worth keeping if vertical columns stay vertical.
+    const std::shared_ptr<const FaceXYBVH> faceXYBVH = faceXYBVH_.Load();
+    const glm::mat3 linear(transform);
+    if (linear[2].x != 0 || linear[2].y != 0 || linear[0].z != 0 ||
+        linear[1].z != 0) {
+      faceXYBVH_.Store(nullptr);
+    } else if (faceXYBVH) {
+      auto transformed = std::make_shared<FaceXYBVH>(*faceXYBVH);
+      transformed->collider.Transform(transform);
+      faceXYBVH_.Store(transformed);
+    }
+  } else {
+    Update();
+  }
 
   const float oldScale = bBox_.Scale();
-  transform_ = glm::mat4x3(1.0f);
   CalculateBBox();
 
   const float newScale = bBox_.Scale();
-  precision_ *= glm::max(1.0f, newScale / oldScale) *
-                glm::max(glm::length(transform_[0]),
-                         glm::max(glm::length(transform_[1]),
-                                  glm::length(transform_[2])));
+  precision_ *= glm::max(1.0f, newScale / oldScale);
 
   // Maximum of inherited precision loss and translational precision loss.
   SetPrecision(precision_);
@@ -615,27 +639,37 @@ void Manifold::Impl::CalculateNormals() {
 /**
  * Returns a sparse array of the bounding box overlaps between the edges of the
  * input manifold, Q and the faces of this manifold. Returned indices only
- * point to forward halfedges.
+ * point to forward halfedges. Rather than querying each edge separately, Q's
+ * edge BVH, which it caches between Booleans, is traversed together with this
+ * manifold's face BVH.
  */
 SparseIndices Manifold::Impl::EdgeCollisions(const Impl& Q) const {
-  VecDH<TmpEdge> edges = CreateTmpEdges(Q.halfedge_);
-  const int numEdge = edges.size();
-  VecDH<Box> QedgeBB(numEdge);
-  thrust::for_each_n(zip(QedgeBB.beginD(), edges.cbeginD()), numEdge,
-                     EdgeBox({Q.vertPos_.cptrD()}));
+  const std::shared_ptr<const EdgeBVH> edgeBVH = Q.GetEdgeBVH();
 
-  SparseIndices q1p2 = collider_.Collisions(QedgeBB);
+  SparseIndices q1p2 = collider_.Collisions(edgeBVH->collider);
 
-  thrust::for_each(q1p2.beginD(0), q1p2.endD(0), ReindexEdge({edges.cptrD()}));
+  thrust::for_each(q1p2.beginD(0), q1p2.endD(0),
+                   ReindexEdge({edgeBVH->edges.cptrD()}));
   return q1p2;
 }
 
 /**
  * Returns a sparse array of the input vertices that project inside the XY
- * bounding boxes of the faces of this manifold.
+ * bounding boxes of the faces of this manifold, sorted by (vertex, face). The
+ * querries use the XY BVH, which this manifold caches between Booleans.
  */
 SparseIndices Manifold::Impl::VertexCollisionsZ(
     const VecDH<glm::vec3>& vertsIn) const {
-  return collider_.Collisions(vertsIn);
+  const std::shared_ptr<const FaceXYBVH> faceXYBVH = GetFaceXYBVH();
+
+  SparseIndices p0q2 = faceXYBVH->collider.Collisions(vertsIn);
+
+  // The collisions come back sorted by vertex, but within each vertex, the
+  // faces are in XY order, so each vertex's row is sorted on its own.
+  thrust::for_each(p0q2.beginD(1), p0q2.endD(1),
+                   ReindexLeaf({faceXYBVH->faces.cptrD()}));
+  thrust::for_each_n(countAt(0), p0q2.size(),
+                     SortRow({p0q2.ptrD(0), p0q2.ptrD(1), p0q2.size()}));
+  return p0q2;
 }
 }  // namespace manifold
\ No newline at end of file
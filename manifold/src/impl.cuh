@@ -13,6 +13,10 @@
 // limitations under the License.
 
 #pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #include "collider.cuh"
 #include "manifold.h"
 #include "shared.cuh"
@@ -22,12 +26,47 @@
 
 namespace manifold {
 
+/** @ingroup Private */
+/**
+ * A shared_ptr that is only ever loaded and stored atomically, including when
+ * it is copied, so that a lazily built cache can be filled in from any thread.
+ */
+template <typename T>
+class AtomicSharedPtr {
+ public:
+  AtomicSharedPtr() {}
+  AtomicSharedPtr(const AtomicSharedPtr& other) : ptr_(other.Load()) {}
+  AtomicSharedPtr& operator=(const AtomicSharedPtr& other) {
+    Store(other.Load());
+    return *this;
+  }
+
+  std::shared_ptr<T> Load() const { return std::atomic_load(&ptr_); }
+  void Store(std::shared_ptr<T> ptr) { std::atomic_store(&ptr_, ptr); }
+
+ private:
+  std::shared_ptr<T> ptr_;
+};
+
 /** @ingroup Private */
 struct Manifold::Impl {
   struct MeshRelationD {
     VecDH<glm::vec3> barycentric;
     VecDH<BaryRef> triBary;
   };
+  // The forward edges, sorted by the Morton codes of their bounding boxes, and
+  // a Collider over those boxes.
+  struct EdgeBVH {
+    VecDH<TmpEdge> edges;
+    Collider collider;
+  };
+  // A Collider over the face boxes, sorted by the Morton codes of their XY
+  // centers, so that each vertical column of faces is a compact subtree, and
+  // the faces in that order.
+  struct FaceXYBVH {
+    VecDH<int> faces;
+    Collider collider;
+  };
 
   Box bBox_;
   float precision_ = -1;
@@ -38,9 +77,24 @@ struct Manifold::Impl {
   VecDH<glm::vec4> halfedgeTangent_;
   MeshRelationD meshRelation_;
   Collider collider_;
-  glm::mat4x3 transform_ = glm::mat4x3(1.0f);
+  // Built on demand by GetEdgeBVH() and shared by copies of this Impl. Any
+  // change to the topology or vertex positions must reset it.
+  mutable AtomicSharedPtr<const EdgeBVH> edgeBVH_;
+  // Likewise, built on demand by GetFaceXYBVH().
+  mutable AtomicSharedPtr<const FaceXYBVH> faceXYBVH_;
+  // Both are built for each operand of a Boolean and kept for the life of this
+  // Impl, so that repeated Booleans with the same operand skip them. With the
+  // BINARY or COMPACT collider layout they take about 160 bytes per triangle,
+  // roughly as much again as the rest of the Impl: 1.5 edges per triangle at
+  // 68 bytes each, plus 60 bytes per triangle for the XY BVH. The WIDE layout
+  // raises this to about 250.
 
   static std::vector<int> meshID2Original_;
+  // Guards meshID2Original_, as Booleans may run on several threads at once.
+  static std::mutex meshIDMutex_;
+  // CollapseEdges finishes serially once a round would collapse fewer edges
+  // than this. Tests set it to 1 or INT_MAX to force either path.
+  static std::atomic<int> minConcurrentCollapses_;
 
   Impl() {}
   enum class Shape { TETRAHEDRON, CUBE, OCTAHEDRON };
@@ -63,8 +117,7 @@ struct Manifold::Impl {
   void CalculateNormals();
 
   void Update();
-  void ApplyTransform() const;
-  void ApplyTransform();
+  void ApplyTransform(const glm::mat4x3& transform);
   SparseIndices EdgeCollisions(const Impl& B) const;
   SparseIndices VertexCollisionsZ(const VecDH<glm::vec3>& vertsIn) const;
 
@@ -83,10 +136,20 @@ struct Manifold::Impl {
 
   // sort.cu
   void Finish();
+  template <typename Code>
+  void SortGeometry();
+  template <typename Code>
   void SortVerts();
   void ReindexVerts(const VecDH<int>& vertNew2Old, int numOldVert);
-  void GetFaceBoxMorton(VecDH<Box>& faceBox, VecDH<uint32_t>& faceMorton) const;
-  void SortFaces(VecDH<Box>& faceBox, VecDH<uint32_t>& faceMorton);
+  template <typename Code>
+  void GetFaceBoxMorton(VecDH<Box>& faceBox, VecDH<Code>& faceMorton) const;
+  void GetFaceBox(VecDH<Box>& faceBox) const;
+  std::shared_ptr<const EdgeBVH> GetEdgeBVH() const;
+  template <typename Code>
+  void BuildEdgeBVH(EdgeBVH& edgeBVH) const;
+  std::shared_ptr<const FaceXYBVH> GetFaceXYBVH() const;
+  template <typename Code>
+  void SortFaces(VecDH<Box>& faceBox, VecDH<Code>& faceMorton);
   void GatherFaces(const VecDH<int>& faceNew2Old);
   void GatherFaces(const Impl& old, const VecDH<int>& faceNew2Old);
 
@@ -98,6 +161,7 @@ struct Manifold::Impl {
 
   // edge_op.cu
   void CollapseDegenerates();
+  void CollapseEdges(VecDH<int>& edges);
   void CollapseEdge(int edge);
   void RecursiveEdgeSwap(int edge);
   void RemoveIfFolded(int edge);
@@ -12,13 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "boolean3.cuh"
+#include "csg_tree.cuh"
 #include "impl.cuh"
+#include "thread_pool.cuh"
 
 namespace {
 using namespace manifold;
 using namespace thrust::placeholders;
 
+// Booleans with fewer input verts than this are run serially, as that is
+// faster than spinning up a thread team for each of their small kernels.
+constexpr int kSerialVerts = 1 << 14;
+
 struct MakeTri {
   const Halfedge* halfedges;
 
@@ -53,52 +61,103 @@ Manifold Halfspace(Box bBox, glm::vec3 normal, float originOffset) {
 
 namespace manifold {
 
-Manifold::Manifold() : pImpl_{std::make_unique<Impl>()} {}
+Manifold::Manifold() : pImpl_{std::make_shared<Impl>()} {}
 Manifold::Manifold(const Mesh& mesh,
                    const std::vector<glm::ivec3>& triProperties,
                    const std::vector<float>& properties,
                    const std::vector<float>& propertyTolerance)
-    : pImpl_{std::make_unique<Impl>(mesh, triProperties, properties,
+    : pImpl_{std::make_shared<Impl>(mesh, triProperties, properties,
                                     propertyTolerance)} {}
 Manifold::~Manifold() = default;
 Manifold::Manifold(Manifold&&) noexcept = default;
 Manifold& Manifold::operator=(Manifold&&) noexcept = default;
 
-Manifold::Manifold(const Manifold& other) : pImpl_(new Impl(*other.pImpl_)) {
-  pImpl_->DuplicateMeshIDs();
-}
+Manifold::Manifold(const Manifold& other)
+    : pImpl_(other.pImpl_),
+      transform_(other.transform_),
+      newMeshIDs_(true),
+      csg_(other.csg_) {}
 
 Manifold& Manifold::operator=(const Manifold& other) {
   if (this != &other) {
-    pImpl_.reset(new Impl(*other.pImpl_));
-    pImpl_->DuplicateMeshIDs();
+    pImpl_ = other.pImpl_;
+    transform_ = other.transform_;
+    newMeshIDs_ = true;
+    csg_ = other.csg_;
   }
   return *this;
 }
 
+/**
+ * Returns the Impl after evaluating any deferred Boolean, but without applying
+ * the pending transform, which is enough for topological queries.
+ */
+const Manifold::Impl& Manifold::GetBaseImpl() const {
+  if (csg_) {
+    // This const_cast is here because evaluating the deferred Boolean leaves
+    // the manifold conceptually unchanged. It is not synchronized, as a single
+    // Manifold is not meant to be shared between threads.
+    Manifold* self = const_cast<Manifold*>(this);
+    self->pImpl_ = csg_->GetResult();
+    self->csg_.reset();
+  }
+  return *pImpl_;
+}
+
+/**
+ * Returns the Impl with any pending transform and mesh ID duplication applied.
+ * The Impl is only copied if there is something pending and it is shared.
+ */
+const Manifold::Impl& Manifold::GetImpl() const {
+  GetBaseImpl();
+  if (transform_ == glm::mat4x3(1.0f) && !newMeshIDs_) return *pImpl_;
+  // This const_cast is here because baking the pending state leaves the
+  // manifold conceptually unchanged. This enables lazy evaluation.
+  return const_cast<Manifold*>(this)->GetMutableImpl();
+}
+
+/**
+ * Returns an Impl owned solely by this manifold, with any pending transform and
+ * mesh ID duplication applied, copying it first if it is shared.
+ */
+Manifold::Impl& Manifold::GetMutableImpl() {
+  GetBaseImpl();
+  if (pImpl_.use_count() > 1) pImpl_ = std::make_shared<Impl>(*pImpl_);
+  if (newMeshIDs_) {
+    pImpl_->DuplicateMeshIDs();
+    newMeshIDs_ = false;
+  }
+  if (transform_ != glm::mat4x3(1.0f)) {
+    pImpl_->ApplyTransform(transform_);
+    transform_ = glm::mat4x3(1.0f);
+  }
+  return *pImpl_;
+}
+
 /**
  * This returns a Mesh of simple vectors of vertices and triangles suitable for
  * saving or other operations outside of the context of this library.
  */
 Mesh Manifold::GetMesh() const {
-  pImpl_->ApplyTransform();
+  const Impl& impl = GetImpl();
 
   Mesh result;
-  result.vertPos.insert(result.vertPos.end(), pImpl_->vertPos_.begin(),
-                        pImpl_->vertPos_.end());
-  result.vertNormal.insert(result.vertNormal.end(), pImpl_->vertNormal_.begin(),
-                           pImpl_->vertNormal_.end());
+  result.vertPos.insert(result.vertPos.end(), impl.vertPos_.begin(),
+                        impl.vertPos_.end());
+  result.vertNormal.insert(result.vertNormal.end(), impl.vertNormal_.begin(),
+                           impl.vertNormal_.end());
   result.halfedgeTangent.insert(result.halfedgeTangent.end(),
-                                pImpl_->halfedgeTangent_.begin(),
-                                pImpl_->halfedgeTangent_.end());
+                                impl.halfedgeTangent_.begin(),
+                                impl.halfedgeTangent_.end());
 
   result.triVerts.resize(NumTri());
   thrust::for_each_n(zip(result.triVerts.begin(), countAt(0)), NumTri(),
-                     MakeTri({pImpl_->halfedge_.cptrH()}));
+                     MakeTri({impl.halfedge_.cptrH()}));
 
   return result;
 }
 
+std::atomic<bool> Manifold::lazyBoolean_(false);
 int Manifold::circularSegments_ = 0;
 float Manifold::circularAngle_ = 10.0f;
 float Manifold::circularEdgeLength_ = 1.0f;
@@ -123,24 +182,21 @@ int Manifold::GetCircularSegments(float radius) {
   if (Manifold::circularSegments_ > 0) return Manifold::circularSegments_;
   int nSegA = 360.0f / Manifold::circularAngle_;
   int nSegL = 2.0f * radius * glm::pi<float>() / Manifold::circularEdgeLength_;
-  int nSeg = min(nSegA, nSegL) + 3;
+  int nSeg = std::min(nSegA, nSegL) + 3;
   nSeg -= nSeg % 4;
   return nSeg;
 }
 
-bool Manifold::IsEmpty() const { return pImpl_->IsEmpty(); }
-int Manifold::NumVert() const { return pImpl_->NumVert(); }
-int Manifold::NumEdge() const { return pImpl_->NumEdge(); }
-int Manifold::NumTri() const { return pImpl_->NumTri(); }
+bool Manifold::IsEmpty() const { return GetBaseImpl().IsEmpty(); }
+int Manifold::NumVert() const { return GetBaseImpl().NumVert(); }
+int Manifold::NumEdge() const { return GetBaseImpl().NumEdge(); }
+int Manifold::NumTri() const { return GetBaseImpl().NumTri(); }
 
 Box Manifold::BoundingBox() const {
-  return pImpl_->bBox_.Transform(pImpl_->transform_);
+  return GetBaseImpl().bBox_.Transform(transform_);
 }
 
-float Manifold::Precision() const {
-  pImpl_->ApplyTransform();
-  return pImpl_->precision_;
-}
+float Manifold::Precision() const { return GetImpl().precision_; }
 
 /**
  * The genus is a topological property of the manifold, representing the number
@@ -158,7 +214,9 @@ int Manifold::Genus() const {
  * within rounding tolerance. This means degenerate manifolds can by identified
  * by testing these properties as == 0.
  */
-Properties Manifold::GetProperties() const { return pImpl_->GetProperties(); }
+Properties Manifold::GetProperties() const {
+  return GetImpl().GetProperties();
+}
 
 /**
  * Curvature is the inverse of the radius of curvature, and signed such that
@@ -168,7 +226,7 @@ Properties Manifold::GetProperties() const { return pImpl_->GetProperties(); }
  * curvature is their sum. This approximates them for every vertex (returned as
  * vectors in the structure) and also returns their minimum and maximum values.
  */
-Curvature Manifold::GetCurvature() const { return pImpl_->GetCurvature(); }
+Curvature Manifold::GetCurvature() const { return GetImpl().GetCurvature(); }
 
 /**
  * Gets the relationship to the previous mesh, for the purpose of assinging
@@ -186,7 +244,7 @@ Curvature Manifold::GetCurvature() const { return pImpl_->GetCurvature(); }
  */
 MeshRelation Manifold::GetMeshRelation() const {
   MeshRelation out;
-  const auto& relation = pImpl_->meshRelation_;
+  const auto& relation = GetImpl().meshRelation_;
   out.triBary.insert(out.triBary.end(), relation.triBary.begin(),
                      relation.triBary.end());
   out.barycentric.insert(out.barycentric.end(), relation.barycentric.begin(),
@@ -203,8 +261,8 @@ MeshRelation Manifold::GetMeshRelation() const {
 std::vector<int> Manifold::GetMeshIDs() const {
   VecDH<int> meshIDs(NumTri());
   thrust::for_each_n(
-      zip(meshIDs.beginD(), pImpl_->meshRelation_.triBary.beginD()), NumTri(),
-      GetMeshID());
+      zip(meshIDs.beginD(), GetImpl().meshRelation_.triBary.beginD()),
+      NumTri(), GetMeshID());
 
   thrust::sort(meshIDs.beginD(), meshIDs.endD());
   int n = thrust::unique(meshIDs.beginD(), meshIDs.endD()) - meshIDs.beginD();
@@ -229,29 +287,34 @@ std::vector<int> Manifold::GetMeshIDs() const {
  * construct a new manifold.
  */
 int Manifold::SetAsOriginal() {
-  int meshID = pImpl_->InitializeNewReference();
+  int meshID = GetMutableImpl().InitializeNewReference();
   return meshID;
 }
 
 std::vector<int> Manifold::MeshID2Original() {
+  std::lock_guard<std::mutex> lock(Manifold::Impl::meshIDMutex_);
   return Manifold::Impl::meshID2Original_;
 }
 
-bool Manifold::IsManifold() const { return pImpl_->IsManifold(); }
+bool Manifold::IsManifold() const { return GetBaseImpl().IsManifold(); }
 
-bool Manifold::MatchesTriNormals() const { return pImpl_->MatchesTriNormals(); }
+bool Manifold::MatchesTriNormals() const {
+  return GetBaseImpl().MatchesTriNormals();
+}
 
-int Manifold::NumDegenerateTris() const { return pImpl_->NumDegenerateTris(); }
+int Manifold::NumDegenerateTris() const {
+  return GetBaseImpl().NumDegenerateTris();
+}
 
 Manifold& Manifold::Translate(glm::vec3 v) {
-  pImpl_->transform_[3] += v;
+  transform_[3] += v;
   return *this;
 }
 
 Manifold& Manifold::Scale(glm::vec3 v) {
   glm::mat3 s(1.0f);
   for (int i : {0, 1, 2}) s[i] *= v;
-  pImpl_->transform_ = s * pImpl_->transform_;
+  transform_ = s * transform_;
   return *this;
 }
 
@@ -272,13 +335,13 @@ Manifold& Manifold::Rotate(float xDegrees, float yDegrees, float zDegrees) {
   glm::mat3 rZ(cosd(zDegrees), sind(zDegrees), 0.0f,   //
                -sind(zDegrees), cosd(zDegrees), 0.0f,  //
                0.0f, 0.0f, 1.0f);
-  pImpl_->transform_ = rZ * rY * rX * pImpl_->transform_;
+  transform_ = rZ * rY * rX * transform_;
   return *this;
 }
 
 Manifold& Manifold::Transform(const glm::mat4x3& m) {
-  glm::mat4 old(pImpl_->transform_);
-  pImpl_->transform_ = m * old;
+  glm::mat4 old(transform_);
+  transform_ = m * old;
   return *this;
 }
 
@@ -290,17 +353,17 @@ Manifold& Manifold::Transform(const glm::mat4x3& m) {
  * with discretion.
  */
 Manifold& Manifold::Warp(std::function<void(glm::vec3&)> warpFunc) {
-  pImpl_->ApplyTransform();
-  thrust::for_each_n(pImpl_->vertPos_.begin(), NumVert(), warpFunc);
-  pImpl_->Update();
-  pImpl_->faceNormal_.resize(0);  // force recalculation of triNormal
-  pImpl_->CalculateNormals();
-  pImpl_->SetPrecision();
+  Impl& impl = GetMutableImpl();
+  thrust::for_each_n(impl.vertPos_.begin(), NumVert(), warpFunc);
+  impl.Update();
+  impl.faceNormal_.resize(0);  // force recalculation of triNormal
+  impl.CalculateNormals();
+  impl.SetPrecision();
   return *this;
 }
 
 Manifold& Manifold::Refine(int n) {
-  pImpl_->Refine(n);
+  GetMutableImpl().Refine(n);
   return *this;
 }
 
@@ -309,22 +372,21 @@ Manifold& Manifold::Refine(int n) {
  * total number of edge-face bounding box overlaps between this and other.
  */
 int Manifold::NumOverlaps(const Manifold& other) const {
-  pImpl_->ApplyTransform();
-  other.pImpl_->ApplyTransform();
+  const Impl& impl = GetImpl();
+  const Impl& otherImpl = other.GetImpl();
 
-  SparseIndices overlaps = pImpl_->EdgeCollisions(*other.pImpl_);
+  SparseIndices overlaps = impl.EdgeCollisions(otherImpl);
   int num_overlaps = overlaps.size();
 
-  overlaps = other.pImpl_->EdgeCollisions(*pImpl_);
+  overlaps = otherImpl.EdgeCollisions(impl);
   return num_overlaps += overlaps.size();
 }
 
 Manifold Manifold::Boolean(const Manifold& second, OpType op) const {
-  pImpl_->ApplyTransform();
-  second.pImpl_->ApplyTransform();
-  Boolean3 boolean(*pImpl_, *second.pImpl_, op);
+  if (lazyBoolean_) return CsgNode::Create(op, *this, second);
+  Boolean3 boolean(GetImpl(), second.GetImpl(), op);
   Manifold result;
-  result.pImpl_ = std::make_unique<Impl>(boolean.Result(op));
+  result.pImpl_ = std::make_shared<Impl>(boolean.Result(op));
   return result;
 }
 
@@ -355,20 +417,173 @@ Manifold& Manifold::operator^=(const Manifold& Q) {
   return *this;
 }
 
+/**
+ * Performs the Boolean op on all of the input manifolds at once; for SUBTRACT,
+ * all the others are subtracted from the first. This is much faster than
+ * chaining the binary operators: operands of a union whose bounding boxes are
+ * disjoint are simply combined with Compose(), subtrahends that miss the first
+ * operand are skipped, and the remainder are reduced in a balanced binary tree
+ * whose independent Booleans are evaluated concurrently on the ThreadPool.
+ * Under the OpenMP backend, small Booleans run single-threaded, as many of them
+ * side by side make better use of the cores than one thread team at a time.
+ */
+Manifold Manifold::BatchBoolean(const std::vector<Manifold>& manifolds,
+                                OpType op) {
+  if (manifolds.empty()) return Manifold();
+  if (manifolds.size() == 1) return manifolds[0];
+
+  // Bake the pending transforms first, as this is the only step that modifies
+  // the inputs; after this the Impls are only read, so they can be shared
+  // between threads.
+  std::vector<std::shared_ptr<Impl>> impls;
+  for (const Manifold& manifold : manifolds) {
+    manifold.GetImpl();
+    impls.push_back(manifold.pImpl_);
+  }
+  // Wraps an Impl without marking it as a copy, so it is never duplicated.
+  auto wrap = [](std::shared_ptr<Impl> impl) {
+    Manifold out;
+    out.pImpl_ = impl;
+    return out;
+  };
+
+  if (op == OpType::SUBTRACT) {
+    const Box& bBox = impls[0]->bBox_;
+    std::vector<Manifold> tools;
+    for (int i = 1; i < impls.size(); ++i) {
+      if (impls[i]->bBox_.DoesOverlap(bBox)) tools.push_back(wrap(impls[i]));
+    }
+    if (tools.empty()) return manifolds[0];
+    const Manifold tool = BatchBoolean(tools, OpType::ADD);
+    SerialScope serial(impls[0]->NumVert() + tool.NumVert() < kSerialVerts);
+    Boolean3 boolean(*impls[0], tool.GetImpl(), op);
+    return wrap(std::make_shared<Impl>(boolean.Result(op)));
+  }
+
+  if (op == OpType::INTERSECT) {
+    Box bBox = impls[0]->bBox_;
+    for (const auto& impl : impls) {
+      bBox.min = glm::max(bBox.min, impl->bBox_.min);
+      bBox.max = glm::min(bBox.max, impl->bBox_.max);
+    }
+    if (glm::any(glm::greaterThan(bBox.min, bBox.max))) return Manifold();
+  }
+
+  if (op == OpType::ADD) {
+    std::vector<int> order;
+    for (int i = 0; i < impls.size(); ++i) {
+      if (!impls[i]->IsEmpty()) order.push_back(i);
+    }
+    if (order.empty()) return Manifold();
+    if (order.size() == 1) return manifolds[order[0]];
+
+    // Greedily sort the operands into groups with disjoint bounding boxes,
+    // sweeping along x so that each group only checks the boxes that can still
+    // reach the current one.
+    std::sort(order.begin(), order.end(), [&impls](int a, int b) {
+      return impls[a]->bBox_.min.x < impls[b]->bBox_.min.x;
+    });
+    struct Group {
+      std::vector<int> members;
+      std::vector<int> active;
+    };
+    std::vector<Group> groups;
+    for (int i : order) {
+      const Box& bBox = impls[i]->bBox_;
+      Group* fit = nullptr;
+      for (Group& group : groups) {
+        std::vector<int>& active = group.active;
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [&](int j) {
+                                      return impls[j]->bBox_.max.x < bBox.min.x;
+                                    }),
+                     active.end());
+        if (std::none_of(active.begin(), active.end(), [&](int j) {
+              return impls[j]->bBox_.DoesOverlap(bBox);
+            })) {
+          fit = &group;
+          break;
+        }
+      }
+      if (fit == nullptr) {
+        groups.emplace_back();
+        fit = &groups.back();
+      }
+      fit->members.push_back(i);
+      fit->active.push_back(i);
+    }
+
+    std::vector<std::shared_ptr<Impl>> composed(groups.size());
+    ParallelFor(groups.size(), [&](int g) {
+      const std::vector<int>& members = groups[g].members;
+      if (members.size() == 1) {
+        composed[g] = impls[members[0]];
+        return;
+      }
+      std::vector<Manifold> parts;
+      int nVert = 0;
+      for (int i : members) {
+        parts.push_back(wrap(impls[i]));
+        nVert += impls[i]->NumVert();
+      }
+      SerialScope serial(nVert < kSerialVerts);
+      composed[g] = Compose(parts).pImpl_;
+    });
+    impls.swap(composed);
+  }
+
+  while (impls.size() > 1) {
+    const int nPairs = impls.size() / 2;
+    std::vector<std::shared_ptr<Impl>> next(impls.size() - nPairs);
+    ParallelFor(nPairs, [&](int i) {
+      const int nVert = impls[2 * i]->NumVert() + impls[2 * i + 1]->NumVert();
+      SerialScope serial(nVert < kSerialVerts);
+      Boolean3 boolean(*impls[2 * i], *impls[2 * i + 1], op);
+      next[i] = std::make_shared<Impl>(boolean.Result(op));
+    });
+    if (impls.size() % 2 == 1) next.back() = impls.back();
+    impls.swap(next);
+  }
+  return wrap(impls[0]);
+}
+
+/**
+ * When enabled, the Boolean operators no longer evaluate immediately, but build
+ * a graph of deferred operations that is evaluated the first time a result's
+ * mesh or properties are needed. Before evaluation, chains of operations are
+ * flattened into BatchBoolean() calls and operands that cannot affect the
+ * result are pruned by their bounding boxes, so scripted models with many
+ * intermediate results only pay for what they use. It is off by default.
+ */
+void Manifold::SetLazyBoolean(bool lazy) { Manifold::lazyBoolean_ = lazy; }
+
+/**
+ * Sets the number of bytes of freed memory kept for reuse by later operations,
+ * which is 256 MiB on CUDA and 64 MiB on the host backends by default. Passing
+ * zero disables the cache.
+ */
+void Manifold::SetMemoryCacheLimit(size_t bytes) {
+  MemoryPool::Get().SetMaxCachedBytes(bytes);
+}
+
+/**
+ * Returns all cached memory to the system, for instance after a batch of
+ * large operations, without changing the limit.
+ */
+void Manifold::ReleaseMemoryCache() { MemoryPool::Get().Release(); }
+
 /**
  * Split cuts this manifold in two using the input manifold. The first result is
  * the intersection, second is the difference. This is more efficient than doing
  * them separately.
  */
 std::pair<Manifold, Manifold> Manifold::Split(const Manifold& cutter) const {
-  pImpl_->ApplyTransform();
-  cutter.pImpl_->ApplyTransform();
-  Boolean3 boolean(*pImpl_, *cutter.pImpl_, OpType::SUBTRACT);
+  Boolean3 boolean(GetImpl(), cutter.GetImpl(), OpType::SUBTRACT);
   std::pair<Manifold, Manifold> result;
   result.first.pImpl_ =
-      std::make_unique<Impl>(boolean.Result(OpType::INTERSECT));
+      std::make_shared<Impl>(boolean.Result(OpType::INTERSECT));
   result.second.pImpl_ =
-      std::make_unique<Impl>(boolean.Result(OpType::SUBTRACT));
+      std::make_shared<Impl>(boolean.Result(OpType::SUBTRACT));
   return result;
 }
 
@@ -388,7 +603,8 @@ std::pair<Manifold, Manifold> Manifold::SplitByPlane(glm::vec3 normal,
  * result.
  */
 Manifold Manifold::TrimByPlane(glm::vec3 normal, float originOffset) const {
-  pImpl_->ApplyTransform();
+  // Bake the transform so the bounding box is tight.
+  GetImpl();
   return *this ^ Halfspace(BoundingBox(), normal, originOffset);
 }
 }  // namespace manifold
\ No newline at end of file
@@ -13,6 +13,8 @@
 // limitations under the License.
 
 #pragma once
+#include <thrust/gather.h>
+#include <thrust/scan.h>
 
 #include "vec_dh.cuh"
 
@@ -162,5 +164,79 @@ struct ReindexEdge {
     edge = edges[edge].halfedgeIdx;
   }
 };
+
+/**
+ * Returns the root of node in the union-find forest given by parent, where
+ * roots are their own parents. Each node passed on the way is pointed to its
+ * grandparent, which keeps the trees shallow. This is safe to run concurrently
+ * with itself and UnionRoots.
+ */
+__host__ __device__ inline int FindRoot(int* parent, int node) {
+  int next = AtomicLoad(parent[node]);
+  while (next != node) {
+    const int grand = AtomicLoad(parent[next]);
+    if (grand != next) AtomicCAS(parent[node], next, grand);
+    node = next;
+    next = AtomicLoad(parent[node]);
+  }
+  return node;
+}
+
+/**
+ * Merges the trees of nodes a and b, concurrently with other calls. The larger
+ * root is always linked under the smaller, so parent[i] <= i throughout, which
+ * rules out cycles, and the root of each tree is its smallest node. If another
+ * thread links the larger root first, the link fails and is retried from the
+ * new roots.
+ */
+__host__ __device__ inline void UnionRoots(int* parent, int a, int b) {
+  for (;;) {
+    a = FindRoot(parent, a);
+    b = FindRoot(parent, b);
+    if (a == b) return;
+    const int small = glm::min(a, b);
+    const int large = glm::max(a, b);
+    if (AtomicCAS(parent[large], large, small) == large) return;
+  }
+}
+
+struct FindRoots {
+  int* parent;
+
+  __host__ __device__ void operator()(thrust::tuple<int&, int> inOut) {
+    thrust::get<0>(inOut) = FindRoot(parent, thrust::get<1>(inOut));
+  }
+};
+
+struct IsRoot {
+  __host__ __device__ int operator()(thrust::tuple<int, int> in) {
+    return thrust::get<0>(in) == thrust::get<1>(in);
+  }
+};
+
+/**
+ * Replaces the union-find forest in components, built with UnionRoots from a
+ * sequence, by component labels and returns their number. Components are
+ * labelled in order of their smallest node.
+ */
+inline int LabelComponents(VecDH<int>& components) {
+  const int numNode = components.size();
+  if (numNode == 0) return 0;
+  VecDH<int> root(numNode);
+  thrust::for_each_n(zip(root.beginD(), countAt(0)), numNode,
+                     FindRoots({components.ptrD()}));
+
+  VecDH<int> label(numNode);
+  thrust::transform_exclusive_scan(
+      poolPolicy(), zip(root.beginD(), countAt(0)),
+      zip(root.endD(), countAt(numNode)), label.beginD(), IsRoot(), 0,
+      thrust::plus<int>());
+  const int numComponent =
+      label.H().back() + (root.H().back() == numNode - 1 ? 1 : 0);
+
+  thrust::gather(root.beginD(), root.endD(), label.beginD(),
+                 components.beginD());
+  return numComponent;
+}
 /** @} */
 }  // namespace manifold
\ No newline at end of file
@@ -474,11 +474,14 @@ Manifold::Impl::MeshRelationD Manifold::Impl::Subdivide(int n) {
   meshRelation_.barycentric.resize(relation.barycentric.size());
   meshRelation_.triBary.resize(relation.triBary.size());
 
-  VecDH<TmpEdge> edges = CreateTmpEdges(halfedge_);
+  // The edge order sets the numbering of the new verts, so don't reuse the
+  // Morton-sorted list a Boolean may have cached: the result would then depend
+  // on whether this mesh had been used in one.
+  const VecDH<TmpEdge> edges = CreateTmpEdges(halfedge_);
   VecDH<int> half2Edge(2 * numEdge);
-  thrust::for_each_n(zip(countAt(0), edges.beginD()), numEdge,
+  thrust::for_each_n(zip(countAt(0), edges.cbeginD()), numEdge,
                      ReindexHalfedge({half2Edge.ptrD()}));
-  thrust::for_each_n(zip(countAt(0), edges.beginD()), numEdge,
+  thrust::for_each_n(zip(countAt(0), edges.cbeginD()), numEdge,
                      EdgeVerts({vertPos_.ptrD(), numVert, n}));
   thrust::for_each_n(
       zip(countAt(0), oldMeshRelation.triBary.beginD()), numTri,
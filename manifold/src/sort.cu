@@ -14,12 +14,32 @@
 
 #include <thrust/sequence.h>
 
+#include <limits>
+
 #include "impl.cuh"
 
 namespace {
 using namespace manifold;
 
-constexpr uint32_t kNoCode = 0xFFFFFFFFu;
+// 30-bit Morton codes give 1024 cells per axis, which is too coarse when there
+// are this many elements, or when the part is this many times longer than it is
+// wide, as then many elements share a code. 63-bit codes are used instead.
+constexpr int kMorton64MinCount = 1 << 20;
+constexpr float kMorton64MinAspect = 64;
+
+template <typename Code>
+__host__ __device__ Code NoCode() {
+  return std::numeric_limits<Code>::max();
+}
+
+bool UseMorton64(int count, const Box& bBox) {
+  if (count >= kMorton64MinCount) return true;
+  const glm::vec3 size = bBox.Size();
+  const float longest = glm::max(size.x, glm::max(size.y, size.z));
+  const float middle = size.x + size.y + size.z - longest -
+                       glm::min(size.x, glm::min(size.y, size.z));
+  return longest > kMorton64MinAspect * middle;
+}
 
 struct Extrema : public thrust::binary_function<Halfedge, Halfedge, Halfedge> {
   __host__ __device__ void MakeForward(Halfedge& a) {
@@ -53,45 +73,116 @@ __host__ __device__ uint32_t SpreadBits3(uint32_t v) {
   return v;
 }
 
-__host__ __device__ uint32_t MortonCode(glm::vec3 position, Box bBox) {
+__host__ __device__ uint64_t SpreadBits3(uint64_t v) {
+  v = 0x001F00000000FFFFull & (v * 0x0000000100000001ull);
+  v = 0x001F0000FF0000FFull & (v * 0x0000000000010001ull);
+  v = 0x100F00F00F00F00Full & (v * 0x0000000000000101ull);
+  v = 0x10C30C30C30C30C3ull & (v * 0x0000000000000011ull);
+  v = 0x1249249249249249ull & (v * 0x0000000000000005ull);
+  return v;
+}
+
+template <typename Code>
+__host__ __device__ Code MortonCode(glm::vec3 position, Box bBox) {
   // Unreferenced vertices are marked NaN, and this will sort them to the end
-  // (the Morton code only uses the first 30 of 32 bits).
-  if (isnan(position.x)) return kNoCode;
+  // (the Morton code only uses the first 30 of 32 bits, or 63 of 64).
+  if (isnan(position.x)) return NoCode<Code>();
 
+  const int bits = sizeof(Code) == 8 ? 21 : 10;
+  const float cells = static_cast<float>(1 << bits);
   glm::vec3 xyz = (position - bBox.min) / (bBox.max - bBox.min);
-  xyz = glm::min(glm::vec3(1023.0f), glm::max(glm::vec3(0.0f), 1024.0f * xyz));
-  uint32_t x = SpreadBits3(static_cast<uint32_t>(xyz.x));
-  uint32_t y = SpreadBits3(static_cast<uint32_t>(xyz.y));
-  uint32_t z = SpreadBits3(static_cast<uint32_t>(xyz.z));
+  xyz = glm::min(glm::vec3(cells - 1), glm::max(glm::vec3(0.0f), cells * xyz));
+  Code x = SpreadBits3(static_cast<Code>(xyz.x));
+  Code y = SpreadBits3(static_cast<Code>(xyz.y));
+  Code z = SpreadBits3(static_cast<Code>(xyz.z));
   return x * 4 + y * 2 + z;
 }
 
+__host__ __device__ uint32_t SpreadBits2(uint32_t v) {
+  v = 0x00FF00FFu & (v | (v << 8));
+  v = 0x0F0F0F0Fu & (v | (v << 4));
+  v = 0x33333333u & (v | (v << 2));
+  v = 0x55555555u & (v | (v << 1));
+  return v;
+}
+
+// A 32-bit Morton code of the XY projection, with 16 bits per axis.
+__host__ __device__ uint32_t MortonCodeXY(glm::vec3 position, Box bBox) {
+  const float cells = static_cast<float>(1 << 16);
+  glm::vec2 xy = (glm::vec2(position) - glm::vec2(bBox.min)) /
+                 (glm::vec2(bBox.max) - glm::vec2(bBox.min));
+  xy = glm::min(glm::vec2(cells - 1), glm::max(glm::vec2(0.0f), cells * xy));
+  uint32_t x = SpreadBits2(static_cast<uint32_t>(xy.x));
+  uint32_t y = SpreadBits2(static_cast<uint32_t>(xy.y));
+  return x * 2 + y;
+}
+
+struct MortonXY {
+  const Box bBox;
+
+  __host__ __device__ void operator()(
+      thrust::tuple<uint32_t&, const Box&> inout) {
+    const Box& box = thrust::get<1>(inout);
+    thrust::get<0>(inout) = MortonCodeXY(box.Center(), bBox);
+  }
+};
+
+template <typename Code>
 struct Morton {
   const Box bBox;
 
   __host__ __device__ void operator()(
-      thrust::tuple<uint32_t&, const glm::vec3&> inout) {
+      thrust::tuple<Code&, const glm::vec3&> inout) {
     glm::vec3 position = thrust::get<1>(inout);
-    thrust::get<0>(inout) = MortonCode(position, bBox);
+    thrust::get<0>(inout) = MortonCode<Code>(position, bBox);
+  }
+};
+
+template <typename Code>
+struct EdgeMortonBox {
+  const glm::vec3* vertPos;
+  const Box bBox;
+
+  __host__ __device__ void operator()(
+      thrust::tuple<Code&, Box&, const TmpEdge&> inout) {
+    Code& mortonCode = thrust::get<0>(inout);
+    Box& edgeBox = thrust::get<1>(inout);
+    const TmpEdge& edge = thrust::get<2>(inout);
+
+    edgeBox = Box(vertPos[edge.first], vertPos[edge.second]);
+    mortonCode = MortonCode<Code>(edgeBox.Center(), bBox);
+  }
+};
+
+struct FaceBox {
+  const Halfedge* halfedge;
+  const glm::vec3* vertPos;
+
+  __host__ __device__ void operator()(thrust::tuple<Box&, int> inout) {
+    Box& faceBox = thrust::get<0>(inout);
+    int face = thrust::get<1>(inout);
+    for (const int i : {0, 1, 2}) {
+      faceBox.Union(vertPos[halfedge[3 * face + i].startVert]);
+    }
   }
 };
 
+template <typename Code>
 struct FaceMortonBox {
   const Halfedge* halfedge;
   const glm::vec3* vertPos;
   const Box bBox;
 
-  __host__ __device__ void operator()(
-      thrust::tuple<uint32_t&, Box&, int> inout) {
-    uint32_t& mortonCode = thrust::get<0>(inout);
+  __host__ __device__ void operator()(thrust::tuple<Code&, Box&, int> inout) {
+    Code& mortonCode = thrust::get<0>(inout);
     Box& faceBox = thrust::get<1>(inout);
     int face = thrust::get<2>(inout);
 
     // Removed tris are marked by all halfedges having pairedHalfedge = -1, and
     // this will sort them to the end (the Morton code only uses the first 30 of
-    // 32 bits).
+    // 32 bits, or 63 of 64).
     if (halfedge[3 * face].pairedHalfedge < 0) {
-      mortonCode = kNoCode;
+      mortonCode = NoCode<Code>();
       return;
     }
 
@@ -104,7 +195,7 @@ struct FaceMortonBox {
     }
     center /= 3;
 
-    mortonCode = MortonCode(center, bBox);
+    mortonCode = MortonCode<Code>(center, bBox);
   }
 };
 
@@ -165,6 +256,8 @@ namespace manifold {
  * and halfedges flagged for removal (NaN verts and -1 halfedges).
  */
 void Manifold::Impl::Finish() {
+  edgeBVH_.Store(nullptr);
+  faceXYBVH_.Store(nullptr);
   if (halfedge_.size() == 0) return;
 
   CalculateBBox();
@@ -176,18 +269,18 @@ void Manifold::Impl::Finish() {
     return;
   }
 
-  SortVerts();
-  VecDH<Box> faceBox;
-  VecDH<uint32_t> faceMorton;
-  GetFaceBoxMorton(faceBox, faceMorton);
-  SortFaces(faceBox, faceMorton);
+  if (UseMorton64(NumTri(), bBox_)) {
+    SortGeometry<uint64_t>();
+  } else {
+    SortGeometry<uint32_t>();
+  }
   if (halfedge_.size() == 0) return;
 
   ALWAYS_ASSERT(halfedge_.size() % 6 == 0, topologyErr,
                 "Not an even number of faces after sorting faces!");
   Halfedge extrema = {0, 0, 0, 0};
-  extrema =
-      thrust::reduce(halfedge_.beginD(), halfedge_.endD(), extrema, Extrema());
+  extrema = thrust::reduce(poolPolicy(), halfedge_.beginD(), halfedge_.endD(),
+                           extrema, Extrema());
 
   ALWAYS_ASSERT(extrema.startVert >= 0, topologyErr,
                 "Vertex index is negative!");
@@ -202,28 +295,44 @@ void Manifold::Impl::Finish() {
                 "Halfedge index exceeds number of halfedges!");
 
   CalculateNormals();
-  collider_ = Collider(faceBox, faceMorton);
+}
+
+/**
+ * Sorts the verts and then the faces by their Morton codes, of type uint32_t or
+ * uint64_t, and builds the collider over the sorted faces.
+ */
+template <typename Code>
+void Manifold::Impl::SortGeometry() {
+  SortVerts<Code>();
+  VecDH<Box> faceBox;
+  VecDH<Code> faceMorton;
+  GetFaceBoxMorton(faceBox, faceMorton);
+  SortFaces(faceBox, faceMorton);
+  collider_ =
+      halfedge_.size() == 0 ? Collider() : Collider(faceBox, faceMorton);
 }
 
 /**
  * Sorts the vertices according to their Morton code.
  */
+template <typename Code>
 void Manifold::Impl::SortVerts() {
-  VecDH<uint32_t> vertMorton(NumVert());
+  VecDH<Code> vertMorton(NumVert());
   thrust::for_each_n(zip(vertMorton.beginD(), vertPos_.cbeginD()), NumVert(),
-                     Morton({bBox_}));
+                     Morton<Code>({bBox_}));
 
   VecDH<int> vertNew2Old(NumVert());
   thrust::sequence(vertNew2Old.beginD(), vertNew2Old.endD());
-  thrust::sort_by_key(vertMorton.beginD(), vertMorton.endD(),
+  thrust::sort_by_key(poolPolicy(), vertMorton.beginD(), vertMorton.endD(),
                       zip(vertPos_.beginD(), vertNew2Old.beginD()));
 
   ReindexVerts(vertNew2Old, NumVert());
 
-  // Verts were flagged for removal with NaNs and assigned kNoCode to sort them
+  // Verts were flagged for removal with NaNs and assigned NoCode to sort them
   // to the end, which allows them to be removed.
   const int newNumVert =
-      thrust::find(vertMorton.beginD(), vertMorton.endD(), kNoCode) -
+      thrust::find(poolPolicy(), vertMorton.beginD(), vertMorton.endD(),
+                   NoCode<Code>()) -
       vertMorton.beginD();
   vertPos_.resize(newNumVert);
 }
@@ -247,31 +356,112 @@ void Manifold::Impl::ReindexVerts(const VecDH<int>& vertNew2Old,
  * codes of the faces, respectively. The Morton code is based on the center of
  * the bounding box.
  */
+template <typename Code>
 void Manifold::Impl::GetFaceBoxMorton(VecDH<Box>& faceBox,
-                                      VecDH<uint32_t>& faceMorton) const {
+                                      VecDH<Code>& faceMorton) const {
   faceBox.resize(NumTri());
   faceMorton.resize(NumTri());
   thrust::for_each_n(
       zip(faceMorton.beginD(), faceBox.beginD(), countAt(0)), NumTri(),
-      FaceMortonBox({halfedge_.cptrD(), vertPos_.cptrD(), bBox_}));
+      FaceMortonBox<Code>({halfedge_.cptrD(), vertPos_.cptrD(), bBox_}));
+}
+
+/**
+ * Fills faceBox with the bounding boxes of the faces, for when their Morton
+ * codes are not needed.
+ */
+void Manifold::Impl::GetFaceBox(VecDH<Box>& faceBox) const {
+  faceBox.resize(NumTri());
+  thrust::for_each_n(zip(faceBox.beginD(), countAt(0)), NumTri(),
+                     FaceBox({halfedge_.cptrD(), vertPos_.cptrD()}));
+}
+
+/**
+ * Returns the edge BVH of this manifold, building it if it is not cached. The
+ * edges are in the same order as the leaves of its Collider, sorted by the
+ * Morton codes of their bounding box centers. If several threads build it at
+ * once, each gets a valid BVH and the last one is kept.
+ */
+std::shared_ptr<const Manifold::Impl::EdgeBVH> Manifold::Impl::GetEdgeBVH()
+    const {
+  std::shared_ptr<const EdgeBVH> cached = edgeBVH_.Load();
+  if (cached) return cached;
+
+  auto edgeBVH = std::make_shared<EdgeBVH>();
+  edgeBVH->edges = CreateTmpEdges(halfedge_);
+  if (UseMorton64(edgeBVH->edges.size(), bBox_)) {
+    BuildEdgeBVH<uint64_t>(*edgeBVH);
+  } else {
+    BuildEdgeBVH<uint32_t>(*edgeBVH);
+  }
+  edgeBVH_.Store(edgeBVH);
+  return edgeBVH;
+}
+
+/**
+ * Sorts the edges by the Morton codes of their bounding box centers, of type
+ * uint32_t or uint64_t, and builds the collider over their boxes.
+ */
+template <typename Code>
+void Manifold::Impl::BuildEdgeBVH(EdgeBVH& edgeBVH) const {
+  VecDH<TmpEdge>& edges = edgeBVH.edges;
+  const int numEdge = edges.size();
+  VecDH<Box> edgeBox(numEdge);
+  VecDH<Code> edgeMorton(numEdge);
+  thrust::for_each_n(
+      zip(edgeMorton.beginD(), edgeBox.beginD(), edges.cbeginD()), numEdge,
+      EdgeMortonBox<Code>({vertPos_.cptrD(), bBox_}));
+
+  thrust::sort_by_key(poolPolicy(), edgeMorton.beginD(), edgeMorton.endD(),
+                      zip(edgeBox.beginD(), edges.beginD()));
+  edgeBVH.collider = Collider(edgeBox, edgeMorton);
+}
+
+/**
+ * Returns the XY BVH of this manifold's faces, building it if it is not cached.
+ * The face Collider is built on 3D Morton codes, which scatter a vertical
+ * column of faces across the tree, while the vertex querries of the Boolean
+ * are vertical lines, so this index is better suited to them.
+ */
+std::shared_ptr<const Manifold::Impl::FaceXYBVH> Manifold::Impl::GetFaceXYBVH()
+    const {
+  std::shared_ptr<const FaceXYBVH> cached = faceXYBVH_.Load();
+  if (cached) return cached;
+
+  auto faceXYBVH = std::make_shared<FaceXYBVH>();
+  VecDH<Box> faceBox;
+  GetFaceBox(faceBox);
+  VecDH<uint32_t> faceMorton(NumTri());
+  thrust::for_each_n(zip(faceMorton.beginD(), faceBox.cbeginD()), NumTri(),
+                     MortonXY({bBox_}));
+
+  VecDH<int>& faces = faceXYBVH->faces;
+  faces.resize(NumTri());
+  thrust::sequence(faces.beginD(), faces.endD());
+  thrust::sort_by_key(poolPolicy(), faceMorton.beginD(), faceMorton.endD(),
+                      zip(faceBox.beginD(), faces.beginD()));
+  if (NumTri() > 0) faceXYBVH->collider = Collider(faceBox, faceMorton);
+  faceXYBVH_.Store(faceXYBVH);
+  return faceXYBVH;
 }
 
 /**
  * Sorts the faces of this manifold according to their input Morton code. The
  * bounding box and Morton code arrays are also sorted accordingly.
  */
-void Manifold::Impl::SortFaces(VecDH<Box>& faceBox,
-                               VecDH<uint32_t>& faceMorton) {
+template <typename Code>
+void Manifold::Impl::SortFaces(VecDH<Box>& faceBox, VecDH<Code>& faceMorton) {
   VecDH<int> faceNew2Old(NumTri());
   thrust::sequence(faceNew2Old.beginD(), faceNew2Old.endD());
 
-  thrust::sort_by_key(faceMorton.beginD(), faceMorton.endD(),
+  thrust::sort_by_key(poolPolicy(), faceMorton.beginD(), faceMorton.endD(),
                       zip(faceBox.beginD(), faceNew2Old.beginD()));
 
-  // Tris were flagged for removal with pairedHalfedge = -1 and assigned kNoCode
+  // Tris were flagged for removal with pairedHalfedge = -1 and assigned NoCode
   // to sort them to the end, which allows them to be removed.
   const int newNumTri =
-      thrust::find(faceMorton.beginD(), faceMorton.endD(), kNoCode) -
+      thrust::find(poolPolicy(), faceMorton.beginD(), faceMorton.endD(),
+                   NoCode<Code>()) -
       faceMorton.beginD();
   faceBox.resize(newNumTri);
   faceMorton.resize(newNumTri);
@@ -0,0 +1,260 @@
+// Copyright 2021 Emmett Lalish
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Unit tests of the internal classes. Unlike the other tests, this file uses
+// Thrust directly, so it is compiled like the libraries, for the same backend.
+
+#include <algorithm>
+#include <climits>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "allocator.cuh"
+#include "collider.cuh"
+#include "gtest/gtest.h"
+#include "impl.cuh"
+#include "manifold.h"
+
+using namespace manifold;
+
+namespace {
+uint32_t SpreadBits3(uint32_t v) {
+  v = 0xFF0000FFu & (v * 0x00010001u);
+  v = 0x0F00F00Fu & (v * 0x00000101u);
+  v = 0xC30C30C3u & (v * 0x00000011u);
+  v = 0x49249249u & (v * 0x00000005u);
+  return v;
+}
+
+// Small boxes scattered over the unit sphere, sorted by the 30-bit Morton codes
+// of their corners.
+void SphereBoxes(VecDH<Box>& leafBB, VecDH<uint32_t>& leafMorton,
+                 int numLeaves) {
+  std::mt19937 generator(1);
+  std::normal_distribution<float> normal;
+  typedef std::pair<uint32_t, Box> Leaf;
+  std::vector<Leaf> leaves;
+  for (int i = 0; i < numLeaves; ++i) {
+    const glm::vec3 corner = glm::normalize(
+        glm::vec3(normal(generator), normal(generator), normal(generator)));
+    uint32_t code = 0;
+    for (int axis : {0, 1, 2}) {
+      const uint32_t cell = glm::min(1023.0f, (corner[axis] + 1) * 512);
+      code |= SpreadBits3(cell) << (2 - axis);
+    }
+    leaves.push_back({code, Box(corner, corner + 0.02f)});
+  }
+  std::sort(leaves.begin(), leaves.end(),
+            [](const Leaf& a, const Leaf& b) { return a.first < b.first; });
+  leafBB.resize(numLeaves);
+  leafMorton.resize(numLeaves);
+  for (int i = 0; i < numLeaves; ++i) {
+    leafMorton.H()[i] = leaves[i].first;
+    leafBB.H()[i] = leaves[i].second;
+  }
+}
+
+void ExpectEqual(const SparseIndices& a, const SparseIndices& b) {
+  EXPECT_GT(a.size(), 0);
+  EXPECT_EQ(a.size(), b.size());
+  EXPECT_TRUE(a.Get(false).H() == b.Get(false).H());
+  EXPECT_TRUE(a.Get(true).H() == b.Get(true).H());
+}
+
+// The triangles of the mesh, each rotated to start at its lowest vert, in
+// sorted order, as neither order is fixed.
+std::vector<glm::ivec3> CanonicalTris(const Mesh& mesh) {
+  std::vector<glm::ivec3> tris;
+  for (glm::ivec3 tri : mesh.triVerts) {
+    while (tri[0] > tri[1] || tri[0] > tri[2]) tri = {tri[1], tri[2], tri[0]};
+    tris.push_back(tri);
+  }
+  std::sort(tris.begin(), tris.end(),
+            [](const glm::ivec3& a, const glm::ivec3& b) {
+              return std::tie(a[0], a[1], a[2]) < std::tie(b[0], b[1], b[2]);
+            });
+  return tris;
+}
+}  // namespace
+
+TEST(MemoryPool, SizeClass) {
+  EXPECT_EQ(MemoryPool::SizeClass(1), 256);
+  EXPECT_EQ(MemoryPool::SizeClass(256), 256);
+  EXPECT_EQ(MemoryPool::SizeClass(257), 288);
+  EXPECT_EQ(MemoryPool::SizeClass(1024), 1024);
+  EXPECT_EQ(MemoryPool::SizeClass(1025), 1152);
+  for (size_t bytes = 257; bytes < (1 << 30); bytes = bytes * 5 / 4 + 1) {
+    const size_t size = MemoryPool::SizeClass(bytes);
+    EXPECT_GE(size, bytes);
+    EXPECT_LE(size, bytes + bytes / 8);
+    EXPECT_EQ(MemoryPool::SizeClass(size), size);
+  }
+}
+
+TEST(MemoryPool, Reuse) {
+  MemoryPool& pool = MemoryPool::Get();
+  pool.Release();
+  void* ptr = pool.Allocate(1000);
+  pool.Deallocate(ptr, 1000);
+  EXPECT_EQ(pool.CachedBytes(), MemoryPool::SizeClass(1000));
+  // Any size of the same class gets the cached block back.
+  EXPECT_EQ(pool.Allocate(1010), ptr);
+  EXPECT_EQ(pool.CachedBytes(), 0);
+  pool.Deallocate(ptr, 1010);
+  pool.Release();
+  EXPECT_EQ(pool.CachedBytes(), 0);
+}
+
+TEST(MemoryPool, Limit) {
+  MemoryPool& pool = MemoryPool::Get();
+  const size_t oldLimit = pool.MaxCachedBytes();
+  pool.Release();
+  pool.SetMaxCachedBytes(2048);
+  void* blocks[3];
+  for (void*& block : blocks) block = pool.Allocate(1024);
+  // The third block would exceed the limit, so it is freed instead.
+  for (void* block : blocks) pool.Deallocate(block, 1024);
+  EXPECT_EQ(pool.CachedBytes(), 2048);
+  // Lowering the limit below the cached bytes releases them.
+  pool.SetMaxCachedBytes(1024);
+  EXPECT_EQ(pool.CachedBytes(), 0);
+  pool.SetMaxCachedBytes(oldLimit);
+}
+
+TEST(MemoryPool, ManifoldCache) {
+  const size_t oldLimit = MemoryPool::Get().MaxCachedBytes();
+  const Manifold sphere = Manifold::Sphere(1, 64);
+  Manifold tool = sphere;
+  tool.Translate(glm::vec3(0.5f));
+  Manifold::SetMemoryCacheLimit(0);
+  EXPECT_FALSE((sphere - tool).IsEmpty());
+  EXPECT_EQ(MemoryPool::Get().CachedBytes(), 0);
+
+  Manifold::SetMemoryCacheLimit(oldLimit);
+  EXPECT_FALSE((sphere - tool).IsEmpty());
+  EXPECT_GT(MemoryPool::Get().CachedBytes(), 0);
+  Manifold::ReleaseMemoryCache();
+  EXPECT_EQ(MemoryPool::Get().CachedBytes(), 0);
+  EXPECT_EQ(MemoryPool::Get().MaxCachedBytes(), oldLimit);
+}
+
+TEST(Collider, Optimize) {
+  VecDH<Box> leafBB;
+  VecDH<uint32_t> leafMorton;
+  SphereBoxes(leafBB, leafMorton, 1 << 12);
+  const Collider optimized(leafBB, leafMorton);
+  const Collider unoptimized(leafBB, leafMorton, false);
+  EXPECT_LE(optimized.SAHCost(), unoptimized.SAHCost());
+
+  VecDH<Box> querries;
+  VecDH<uint32_t> unused;
+  SphereBoxes(querries, unused, 1 << 10);
+  ExpectEqual(optimized.Collisions(querries), unoptimized.Collisions(querries));
+
+  SparseIndices dual = optimized.Collisions(optimized);
+  SparseIndices unoptimizedDual = unoptimized.Collisions(unoptimized);
+  dual.Sort();
+  unoptimizedDual.Sort();
+  ExpectEqual(dual, unoptimizedDual);
+}
+
+// Every layout finds the same overlaps, including against the other layouts,
+// and keeps finding them after its boxes are transformed or updated.
+TEST(Collider, Layouts) {
+  VecDH<Box> leafBB;
+  VecDH<uint32_t> leafMorton;
+  SphereBoxes(leafBB, leafMorton, 1 << 12);
+  VecDH<Box> querries;
+  VecDH<uint32_t> unused;
+  SphereBoxes(querries, unused, 1 << 10);
+  VecDH<glm::vec3> points(querries.size());
+  for (int i = 0; i < querries.size(); ++i) {
+    points.H()[i] = querries.H()[i].Center();
+  }
+
+  std::vector<Collider> colliders;
+  for (BVHLayout layout :
+       {BVHLayout::BINARY, BVHLayout::WIDE, BVHLayout::COMPACT}) {
+    colliders.emplace_back(leafBB, leafMorton, true, layout);
+  }
+  auto ExpectSame = [&colliders, &points](const VecDH<Box>& querries) {
+    const Collider& binary = colliders[0];
+    SparseIndices dual = binary.Collisions(binary);
+    dual.Sort();
+    for (const Collider& collider : colliders) {
+      // Summed in a different order by COMPACT, which renumbers the nodes.
+      EXPECT_NEAR(collider.SAHCost(), binary.SAHCost(),
+                  1e-4f * binary.SAHCost());
+      ExpectEqual(collider.Collisions(querries), binary.Collisions(querries));
+      ExpectEqual(collider.Collisions(points), binary.Collisions(points));
+      for (const Collider& other : colliders) {
+        SparseIndices otherDual = collider.Collisions(other);
+        otherDual.Sort();
+        ExpectEqual(otherDual, dual);
+      }
+    }
+  };
+  ExpectSame(querries);
+
+  // Axis-aligned, so it is applied to the boxes, and flipped in x.
+  glm::mat4x3 flip(1.0f);
+  flip[0][0] = -2;
+  flip[3] = glm::vec3(0.1f, 0, 0);
+  for (Collider& collider : colliders) EXPECT_TRUE(collider.Transform(flip));
+  VecDH<Box> flipped(querries.size());
+  for (int i = 0; i < querries.size(); ++i) {
+    flipped.H()[i] = querries.H()[i].Transform(flip);
+  }
+  ExpectSame(flipped);
+
+  VecDH<Box> moved(leafBB.size());
+  for (int i = 0; i < leafBB.size(); ++i) {
+    const glm::vec3 offset(0, 0.01f * (i % 3), 0);
+    moved.H()[i] = Box(leafBB.H()[i].min + offset, leafBB.H()[i].max + offset);
+  }
+  for (Collider& collider : colliders) collider.UpdateBoxes(moved);
+  ExpectSame(querries);
+}
+
+// Short edges, some sharing a vert, collapse to the same mesh whether the
+// concurrent rounds of CollapseEdges run or only its serial loop. Both start
+// from the same Mesh, as the triangle order of a Boolean's result can vary.
+TEST(CollapseEdges, MatchesSerial) {
+  Mesh mesh = Manifold::Sphere(1, 128).GetMesh();
+  for (int tri = 0; tri < mesh.triVerts.size(); tri += 3) {
+    const glm::ivec3 verts = mesh.triVerts[tri];
+    mesh.vertPos[verts[1]] =
+        glm::mix(mesh.vertPos[verts[0]], mesh.vertPos[verts[1]], 1e-5f);
+  }
+  const int oldMin = Manifold::Impl::minConcurrentCollapses_;
+
+  Manifold::Impl::minConcurrentCollapses_ = 1;
+  const Manifold concurrent(mesh);
+  EXPECT_TRUE(concurrent.IsManifold());
+  const Mesh concurrentMesh = concurrent.GetMesh();
+
+  Manifold::Impl::minConcurrentCollapses_ = INT_MAX;
+  const Mesh serialMesh = Manifold(mesh).GetMesh();
+  Manifold::Impl::minConcurrentCollapses_ = oldMin;
+
+  EXPECT_LT(serialMesh.vertPos.size(), mesh.vertPos.size());
+  EXPECT_TRUE(concurrentMesh.vertPos == serialMesh.vertPos);
+  EXPECT_TRUE(CanonicalTris(concurrentMesh) == CanonicalTris(serialMesh));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -424,6 +424,18 @@ TEST(Manifold, Transform) {
   Identical(cube.GetMesh(), cube2.GetMesh());
 }
 
+TEST(Manifold, CopyOnWrite) {
+  Manifold cube = Manifold::Cube();
+  const Mesh original = cube.GetMesh();
+  Manifold copy = cube;
+  copy.Translate({1, 0, 0}).Warp([](glm::vec3& v) { v.z *= 2; });
+
+  Identical(cube.GetMesh(), original);
+  EXPECT_FLOAT_EQ(copy.BoundingBox().min.x, 1);
+  EXPECT_FLOAT_EQ(copy.BoundingBox().max.z, 2);
+  EXPECT_NE(cube.GetMeshIDs()[0], copy.GetMeshIDs()[0]);
+}
+
 TEST(Manifold, MeshRelation) {
   std::vector<Mesh> input;
   std::map<int, int> meshID2idx;
@@ -663,6 +675,147 @@ TEST(Boolean, NonIntersecting) {
   EXPECT_TRUE((cube1 ^ cube2).IsEmpty());
 }
 
+TEST(Boolean, ReuseTool) {
+  const Manifold target = Manifold::Cube({2.0f, 1.0f, 1.0f});
+  Manifold tool = Manifold::Cube({0.5f, 0.5f, 2.0f});
+  tool.Translate({0.25f, 0.25f, -0.5f});
+  Manifold result = target - tool;
+  EXPECT_NEAR(result.GetProperties().volume, 1.75f, 1e-4);
+  // An axis-aligned transform updates the tool's cached edges.
+  Manifold moved = tool;
+  moved.Translate({1.0f, 0.0f, 0.0f});
+  result -= moved;
+  EXPECT_NEAR(result.GetProperties().volume, 1.5f, 1e-4);
+  // Any other transform rebuilds them.
+  Manifold rotated = tool;
+  rotated.Rotate(0.0f, 0.0f, 45.0f).Translate({1.0f, -0.2071f, 0.0f});
+  EXPECT_NEAR((target - rotated).GetProperties().volume, 1.75f, 1e-4);
+  EXPECT_NEAR((target - tool).GetProperties().volume, 1.75f, 1e-4);
+}
+
+TEST(Boolean, Rotated) {
+  Manifold block = Manifold::Cube(glm::vec3(2.0f), true);
+  block.Rotate(10.0f, 20.0f, 30.0f);
+  Manifold inner = Manifold::Cube(glm::vec3(1.0f), true);
+  inner.Rotate(30.0f, 40.0f, 50.0f);
+  Manifold hollow = block - inner;
+  EXPECT_TRUE(hollow.IsManifold());
+  EXPECT_NEAR(hollow.GetProperties().volume, 7.0f, 1e-4);
+
+  Manifold drill = Manifold::Cube({0.5f, 0.5f, 4.0f}, true);
+  drill.Rotate(0.0f, 0.0f, 30.0f);
+  Manifold drilled = Manifold::Cube(glm::vec3(2.0f), true) - drill;
+  EXPECT_TRUE(drilled.IsManifold());
+  EXPECT_NEAR(drilled.GetProperties().volume, 7.5f, 1e-4);
+}
+
+TEST(Boolean, LongThin) {
+  // Long enough to be sorted by 64-bit Morton codes.
+  Manifold rod = Manifold::Cube({200.0f, 1.0f, 1.0f});
+  for (float x : {10.0f, 100.0f, 190.0f}) {
+    Manifold notch = Manifold::Cube({1.0f, 0.5f, 2.0f});
+    notch.Translate({x, 0.5f, -0.5f});
+    rod -= notch;
+  }
+  EXPECT_TRUE(rod.IsManifold());
+  EXPECT_NEAR(rod.GetProperties().volume, 200.0f - 3 * 0.5f, 1e-3);
+}
+
+TEST(Boolean, Tall) {
+  Manifold post = Manifold::Cube({1.0f, 1.0f, 50.0f});
+  for (float z : {5.0f, 25.0f, 45.0f}) {
+    Manifold hole = Manifold::Cube({2.0f, 0.5f, 0.5f});
+    hole.Translate({-0.5f, 0.25f, z});
+    post -= hole;
+  }
+  EXPECT_TRUE(post.IsManifold());
+  EXPECT_NEAR(post.GetProperties().volume, 50.0f - 3 * 0.25f, 1e-3);
+
+  // Reuse the post as a tool, turned about Z, and then laid down.
+  const Manifold block = Manifold::Cube(glm::vec3(4.0f), true);
+  Manifold tool = post;
+  tool.Translate({-0.5f, -0.5f, -25.0f}).Rotate(0.0f, 0.0f, 30.0f);
+  Manifold result = block - tool;
+  EXPECT_TRUE(result.IsManifold());
+  EXPECT_NEAR(result.GetProperties().volume, 64.0f - 3.75f, 1e-3);
+
+  tool.Rotate(90.0f, 0.0f, 0.0f);
+  result = block - tool;
+  EXPECT_TRUE(result.IsManifold());
+  EXPECT_NEAR(result.GetProperties().volume, 64.0f - 3.75f, 1e-3);
+}
+
+TEST(Boolean, BatchBoolean) {
+  std::vector<Manifold> cubes;
+  for (int i = 0; i < 8; ++i) {
+    cubes.push_back(Manifold::Cube().Translate({0.75f * i, 0.0f, 0.0f}));
+  }
+  Manifold sum = Manifold::BatchBoolean(cubes, Manifold::OpType::ADD);
+  EXPECT_TRUE(sum.IsManifold());
+  EXPECT_NEAR(sum.GetProperties().volume, 6.25f, 1e-4);
+
+  std::vector<Manifold> parts;
+  parts.push_back(Manifold::Cube({7.0f, 1.0f, 1.0f}));
+  for (float x : {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 20.0f}) {
+    parts.push_back(
+        Manifold::Cube(glm::vec3(0.5f)).Translate({x, 0.25f, 0.25f}));
+  }
+  Manifold difference =
+      Manifold::BatchBoolean(parts, Manifold::OpType::SUBTRACT);
+  EXPECT_TRUE(difference.IsManifold());
+  EXPECT_NEAR(difference.GetProperties().volume, 7.0f - 5 * 0.125f, 1e-4);
+
+  cubes.resize(2);
+  Manifold overlap = Manifold::BatchBoolean(cubes, Manifold::OpType::INTERSECT);
+  EXPECT_NEAR(overlap.GetProperties().volume, 0.25f, 1e-4);
+  cubes.push_back(Manifold::Cube().Translate({2.0f, 0.0f, 0.0f}));
+  EXPECT_TRUE(
+      Manifold::BatchBoolean(cubes, Manifold::OpType::INTERSECT).IsEmpty());
+}
+
+TEST(Boolean, LazyBoolean) {
+  Manifold::SetLazyBoolean(true);
+  Manifold block = Manifold::Cube({4.0f, 1.0f, 1.0f});
+  Manifold result = block;
+  for (float x : {1.0f, 2.0f, 10.0f}) {
+    result -= Manifold::Cube(glm::vec3(0.5f)).Translate({x, 0.25f, 0.25f});
+  }
+  result.Translate({1.0f, 0.0f, 0.0f}).Translate({0.0f, 1.0f, 0.0f});
+  EXPECT_TRUE(result.IsManifold());
+  EXPECT_NEAR(result.GetProperties().volume, 4.0f - 2 * 0.125f, 1e-4);
+  EXPECT_FLOAT_EQ(result.BoundingBox().min.x, 1.0f);
+  EXPECT_FLOAT_EQ(result.BoundingBox().min.y, 1.0f);
+
+  Manifold cubes =
+      Manifold::Cube() + Manifold::Cube().Translate({5.0f, 0.0f, 0.0f});
+  Manifold inner =
+      Manifold::Cube(glm::vec3(0.5f)).Translate(glm::vec3(0.25f));
+  EXPECT_NEAR((cubes ^ inner).GetProperties().volume, 0.125f, 1e-4);
+  EXPECT_NEAR(cubes.GetProperties().volume, 2.0f, 1e-4);
+  Manifold::SetLazyBoolean(false);
+}
+
+TEST(Boolean, LazyDAG) {
+  Manifold::SetLazyBoolean(true);
+  Manifold shared = Manifold::Cube() - Manifold::Cube(glm::vec3(0.5f))
+                                           .Translate(glm::vec3(0.25f));
+  std::vector<Manifold> copies;
+  for (int i = 0; i < 4; ++i) {
+    copies.push_back(shared);
+    copies.back().Translate({2.0f * i, 0.0f, 0.0f});
+  }
+  Manifold left = copies[0] + copies[1];
+  Manifold right = copies[2] + copies[3];
+  Manifold all = left ^ Manifold::Cube({3.5f, 1.5f, 1.5f}).Translate(
+                            glm::vec3(-0.25f));
+  all = (all + right) -
+        Manifold::Cube(glm::vec3(0.4f)).Translate(glm::vec3(-0.2f));
+  EXPECT_TRUE(all.IsManifold());
+  EXPECT_NEAR(all.GetProperties().volume, 4 * 0.875f - 0.008f, 1e-4);
+  EXPECT_NEAR(shared.GetProperties().volume, 0.875f, 1e-4);
+  Manifold::SetLazyBoolean(false);
+}
+
 TEST(Boolean, Precision) {
   Manifold cube = Manifold::Cube();
   Manifold cube2 = cube;
@@ -0,0 +1,66 @@
+// Copyright 2021 Emmett Lalish
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+#include "manifold.h"
+
+using namespace manifold;
+
+namespace {
+
+// Returns the best of several runs, in milliseconds.
+double Time(const std::function<void()>& func, int nRuns = 5) {
+  double best = 1e20;
+  for (int i = 0; i < nRuns; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> elapsed = end - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+}  // namespace
+
+/*
+ * Times the data-parallel kernels that dominate the non-Boolean operations, so
+ * that host-compiler builds (MANIFOLD_USE_OMP/CPP/TBB) can be compared with
+ * and without -march=native, LTO and PGO:
+ *  - transform: Transform4x3 and TransformNormals, via a lazy Translate.
+ *  - normals: face and vertex normals (AssignNormals), via an identity Warp.
+ *  - construct: Morton codes and the vertex and face sorts, via Manifold(Mesh).
+ */
+int main(int argc, char **argv) {
+  for (int i = 0; i < 5; ++i) {
+    const Manifold sphere = Manifold::Sphere(1, (32 << i) * 4);
+    const Mesh mesh = sphere.GetMesh();
+
+    Manifold manifold = sphere;
+    const double transform = Time([&manifold]() {
+      manifold.Translate(glm::vec3(1.0f));
+      manifold.Precision();
+    });
+    const double normals =
+        Time([&manifold]() { manifold.Warp([](glm::vec3 &v) {}); });
+    const double construct = Time([&mesh]() { Manifold manifold(mesh); });
+
+    std::cout << "nTri = " << sphere.NumTri() << ", transform = " << transform
+              << " ms, normals = " << normals
+              << " ms, construct = " << construct << " ms" << std::endl;
+  }
+}
@@ -0,0 +1,259 @@
+// Copyright 2021 Emmett Lalish
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include <thrust/device_malloc_allocator.h>
+#include <thrust/execution_policy.h>
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace manifold {
+
+/** @addtogroup Private
+ *  @{
+ */
+
+/**
+ * A thread-safe pool of device memory blocks shared by the whole library.
+ * Freed blocks are kept, bucketed by size class, and handed back out to later
+ * allocations of the same class, so repeated Boolean operations stop paying
+ * for the system allocator and fresh page faults. Blocks beyond the cache
+ * limit are returned to the system immediately.
+ */
+class MemoryPool {
+ public:
+  static MemoryPool& Get() {
+    // Intentionally leaked, so that static VecDHs may outlive it safely.
+    static MemoryPool* pool = new MemoryPool();
+    return *pool;
+  }
+
+  void* Allocate(size_t bytes) {
+    if (bytes == 0) return nullptr;
+    const size_t size = SizeClass(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto block = free_.find(size);
+      if (block != free_.end()) {
+        void* ptr = block->second;
+        free_.erase(block);
+        cachedBytes_ -= size;
+        return ptr;
+      }
+    }
+    void* ptr = SystemAllocate(size);
+    if (ptr == nullptr) {
+      Release();
+      ptr = SystemAllocate(size);
+      if (ptr == nullptr) throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  void Deallocate(void* ptr, size_t bytes) {
+    if (ptr == nullptr) return;
+    const size_t size = SizeClass(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cachedBytes_ + size <= maxCachedBytes_) {
+        free_.emplace(size, ptr);
+        cachedBytes_ += size;
+        return;
+      }
+    }
+    SystemFree(ptr);
+  }
+
+  /**
+   * Returns all cached blocks to the system.
+   */
+  void Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& block : free_) SystemFree(block.second);
+    free_.clear();
+    cachedBytes_ = 0;
+  }
+
+  /**
+   * Sets the maximum number of bytes kept in the cache. Passing zero disables
+   * caching.
+   */
+  void SetMaxCachedBytes(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      maxCachedBytes_ = bytes;
+      if (cachedBytes_ <= maxCachedBytes_) return;
+    }
+    Release();
+  }
+
+  size_t MaxCachedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return maxCachedBytes_;
+  }
+
+  size_t CachedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cachedBytes_;
+  }
+
+  // Rounds up to one of eight steps per power of two, which bounds the wasted
+  // space to 12.5% while keeping the number of distinct classes small.
+  static size_t SizeClass(size_t bytes) {
+    const size_t kMinBlock = 256;
+    if (bytes <= kMinBlock) return kMinBlock;
+    size_t step = kMinBlock / 16;
+    while (step * 16 < bytes) step <<= 1;
+    return (bytes + step - 1) / step * step;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::multimap<size_t, void*> free_;
+  size_t cachedBytes_ = 0;
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+  // Device memory is slow to allocate, and running out of it releases the
+  // cache anyway, but it is also scarce, so cached blocks count against the
+  // peak use of the process.
+  size_t maxCachedBytes_ = size_t(1) << 28;
+#else
+  // malloc rarely fails on the host, so a full cache would never be released;
+  // keep it to the blocks of a moderate Boolean, as larger ones are dominated
+  // by their kernels rather than by allocation.
+  size_t maxCachedBytes_ = size_t(1) << 26;
+#endif
+
+  MemoryPool() {}
+
+  static void* SystemAllocate(size_t bytes) {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+    void* ptr = nullptr;
+    if (cudaMalloc(&ptr, bytes) != cudaSuccess) {
+      cudaGetLastError();
+      return nullptr;
+    }
+    return ptr;
+#else
+    return std::malloc(bytes);
+#endif
+  }
+
+  static void SystemFree(void* ptr) {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+    cudaFree(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+};
+
+/**
+ * Allocator for the temporary storage of Thrust algorithms, backed by the
+ * MemoryPool. It is stateless, so any instance can free another's memory.
+ */
+struct CachedAllocator {
+  typedef char value_type;
+
+  char* allocate(std::ptrdiff_t bytes) {
+    return static_cast<char*>(MemoryPool::Get().Allocate(bytes));
+  }
+
+  void deallocate(char* ptr, size_t bytes) {
+    MemoryPool::Get().Deallocate(ptr, bytes);
+  }
+};
+
+/**
+ * The device execution policy with its temporary storage drawn from the
+ * MemoryPool. Pass this as the first argument of Thrust algorithms that
+ * allocate scratch space (sort, scan, reduce_by_key, copy_if, etc.).
+ */
+inline auto poolPolicy() {
+  static CachedAllocator alloc;
+  return thrust::device(alloc);
+}
+
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+/**
+ * Element allocator for device_vector, backed by the MemoryPool.
+ */
+template <typename T>
+struct PoolAllocator : thrust::device_malloc_allocator<T> {
+  typedef thrust::device_malloc_allocator<T> Base;
+  typedef typename Base::pointer pointer;
+  typedef typename Base::size_type size_type;
+
+  template <typename U>
+  struct rebind {
+    typedef PoolAllocator<U> other;
+  };
+
+  PoolAllocator() {}
+  PoolAllocator(const PoolAllocator&) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  pointer allocate(size_type n) {
+    return pointer(
+        static_cast<T*>(MemoryPool::Get().Allocate(n * sizeof(T))));
+  }
+
+  void deallocate(pointer ptr, size_type n) {
+    MemoryPool::Get().Deallocate(ptr.get(), n * sizeof(T));
+  }
+};
+#else
+/**
+ * Element allocator for the shared host/device buffer of VecDH on the CPU
+ * backends, backed by the MemoryPool.
+ */
+template <typename T>
+struct PoolAllocator : std::allocator<T> {
+  typedef typename std::allocator<T>::size_type size_type;
+
+  template <typename U>
+  struct rebind {
+    typedef PoolAllocator<U> other;
+  };
+
+  PoolAllocator() {}
+  PoolAllocator(const PoolAllocator&) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(size_type n, const void* = 0) {
+    return static_cast<T*>(MemoryPool::Get().Allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_type n) {
+    MemoryPool::Get().Deallocate(ptr, n * sizeof(T));
+  }
+};
+#endif
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return false;
+}
+/** @} */
+}  // namespace manifold
@@ -17,6 +17,7 @@
 #include <thrust/gather.h>
 #include <thrust/remove.h>
 #include <thrust/sort.h>
+#include <thrust/transform.h>
 #include <thrust/unique.h>
 
 #include "structs.h"
@@ -66,7 +67,41 @@ class SparseIndices {
   int size() const { return p.size(); }
   void SwapPQ() { p.swap(q); }
 
-  void Sort() { thrust::sort(beginDpq(), endDpq()); }
+  // Packs (p, q) into a single key whose unsigned order is the lexicographic
+  // order of the signed pair, so sorts and searches compare one 64-bit key.
+  struct PackKey {
+    __host__ __device__ uint64_t operator()(thrust::tuple<int, int> pq) const {
+      const uint32_t p = static_cast<uint32_t>(thrust::get<0>(pq)) ^ kSignBit;
+      const uint32_t q = static_cast<uint32_t>(thrust::get<1>(pq)) ^ kSignBit;
+      return (static_cast<uint64_t>(p) << 32) | q;
+    }
+  };
+
+  struct UnpackKey {
+    __host__ __device__ thrust::tuple<int, int> operator()(uint64_t key) const {
+      const uint32_t p = static_cast<uint32_t>(key >> 32) ^ kSignBit;
+      const uint32_t q = static_cast<uint32_t>(key) ^ kSignBit;
+      return thrust::make_tuple(static_cast<int>(p), static_cast<int>(q));
+    }
+  };
+
+  VecDH<uint64_t> Keys() const {
+    VecDH<uint64_t> keys(size());
+    thrust::transform(beginDpq(), endDpq(), keys.beginD(), PackKey());
+    return keys;
+  }
+
+  void SetKeys(const VecDH<uint64_t>& keys) {
+    Resize(keys.size());
+    thrust::transform(keys.beginD(), keys.endD(), beginDpq(), UnpackKey());
+  }
+
+  // Sorting the packed keys, rather than tuples, lets Thrust use a radix sort.
+  void Sort() {
+    VecDH<uint64_t> keys = Keys();
+    thrust::sort(poolPolicy(), keys.beginD(), keys.endD());
+    SetKeys(keys);
+  }
 
   void Resize(int size) {
     p.resize(size, -1);
@@ -74,9 +109,13 @@ class SparseIndices {
   }
 
   void Unique() {
-    Sort();
-    int newSize = thrust::unique(beginDpq(), endDpq()) - beginDpq();
-    Resize(newSize);
+    VecDH<uint64_t> keys = Keys();
+    thrust::sort(poolPolicy(), keys.beginD(), keys.endD());
+    const int newSize =
+        thrust::unique(poolPolicy(), keys.beginD(), keys.endD()) -
+        keys.beginD();
+    keys.resize(newSize);
+    SetKeys(keys);
   }
 
   struct firstZero {
@@ -90,7 +129,8 @@ class SparseIndices {
                   "Different number of values than indicies!");
     auto zBegin = zip(S.beginD(), beginD(false), beginD(true));
     auto zEnd = zip(S.endD(), endD(false), endD(true));
-    size_t size = thrust::remove_if(zBegin, zEnd, firstZero()) - zBegin;
+    size_t size =
+        thrust::remove_if(poolPolicy(), zBegin, zEnd, firstZero()) - zBegin;
     S.resize(size, -1);
     p.resize(size, -1);
     q.resize(size, -1);
@@ -123,7 +163,9 @@ class SparseIndices {
                   "Different number of values than indicies!");
     auto zBegin = zip(v.beginD(), x.beginD(), beginD(false), beginD(true));
     auto zEnd = zip(v.endD(), x.endD(), endD(false), endD(true));
-    size_t size = thrust::remove_if(zBegin, zEnd, firstNonFinite<T>()) - zBegin;
+    size_t size = thrust::remove_if(poolPolicy(), zBegin, zEnd,
+                                    firstNonFinite<T>()) -
+                  zBegin;
     v.resize(size);
     x.resize(size, -1);
     p.resize(size, -1);
@@ -131,23 +173,6 @@ class SparseIndices {
     return size;
   }
 
-  template <typename Iter, typename T>
-  VecDH<T> Gather(const VecDH<T>& val, const Iter pqBegin, const Iter pqEnd,
-                  T missingVal) const {
-    ALWAYS_ASSERT(val.size() == p.size(), userErr,
-                  "Different number of values than indicies!");
-    size_t size = pqEnd - pqBegin;
-    VecDH<T> result(size);
-    VecDH<bool> found(size);
-    VecDH<int> temp(size);
-    thrust::fill(result.beginD(), result.endD(), missingVal);
-    thrust::binary_search(beginDpq(), endDpq(), pqBegin, pqEnd, found.beginD());
-    thrust::lower_bound(beginDpq(), endDpq(), pqBegin, pqEnd, temp.beginD());
-    thrust::gather_if(temp.beginD(), temp.endD(), found.beginD(), val.beginD(),
-                      result.beginD());
-    return result;
-  }
-
   void Dump() const {
     const auto& p = Get(0).H();
     const auto& q = Get(1).H();
@@ -159,6 +184,7 @@ class SparseIndices {
   }
 
  private:
+  static constexpr uint32_t kSignBit = 0x80000000u;
   VecDH<int> p, q;
 };
 }  // namespace manifold
\ No newline at end of file
@@ -15,6 +15,7 @@
 #pragma once
 #define GLM_FORCE_EXPLICIT_CTOR
 #include <chrono>
+#include <cmath>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
@@ -65,6 +66,10 @@ void AlwaysAssert(bool condition, const char* file, int line,
 #define HOST_DEVICE __host__ __device__
 #else
 #define HOST_DEVICE
+// nvcc provides these unqualified in the global namespace; host compilers
+// only have them in std.
+using std::isfinite;
+using std::isnan;
 #endif
 
 inline HOST_DEVICE int Signum(float val) { return (val > 0) - (val < 0); }
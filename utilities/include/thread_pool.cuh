@@ -0,0 +1,220 @@
+// Copyright 2021 Emmett Lalish
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include <thrust/execution_policy.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_OMP
+#include <omp.h>
+#endif
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_TBB
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#endif
+
+namespace manifold {
+
+/** @addtogroup Private
+ *  @{
+ */
+
+/**
+ * A pool of host threads shared by the whole library, for running coarse,
+ * independent tasks that each launch their own Thrust algorithms, such as the
+ * Booleans of a BatchBoolean or of a CSG tree. The caller of ParallelFor takes
+ * part in the work until none is left to start, so nested calls cannot
+ * deadlock. While it waits for the other threads to finish, it does not run
+ * tasks of other batches, as these may take locks it holds. It is not used by
+ * the TBB backend, which schedules these tasks in the caller's task arena.
+ */
+class ThreadPool {
+ public:
+  static ThreadPool& Get() {
+    // Intentionally leaked, as its workers never exit.
+    static ThreadPool* pool = new ThreadPool();
+    return *pool;
+  }
+
+  /**
+   * Calls func(i) for each i in [0, n), concurrently, and rethrows the first
+   * exception once they have all finished. After an exception, the remaining
+   * calls are skipped.
+   */
+  void ParallelFor(int n, std::function<void(int)> func) {
+    if (n <= 0) return;
+    auto batch = std::make_shared<Batch>();
+    batch->n = n;
+    batch->func = std::move(func);
+    batch->pool = this;
+
+    const int nHelpers = std::min<int>(n, workers_.size() + 1) - 1;
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_OMP
+    // Each task forks its own OpenMP team, so share out this thread's team
+    // between the concurrent tasks rather than oversubscribing the cores.
+    batch->teamSize = std::max(1, omp_get_max_threads() / (nHelpers + 1));
+#endif
+    if (nHelpers > 0) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < nHelpers; ++i) {
+          queue_.push_back([batch]() { batch->Run(); });
+        }
+      }
+      cv_.notify_all();
+    }
+
+    batch->Run();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      waiting_.wait(lock, [&batch, n]() { return batch->done == n; });
+    }
+    if (batch->error) std::rethrow_exception(batch->error);
+  }
+
+ private:
+  struct Batch {
+    int n;
+    std::function<void(int)> func;
+    ThreadPool* pool;
+    int teamSize = 1;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex mutex;
+
+    void Run() {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_OMP
+      const int oldThreads = omp_get_max_threads();
+      omp_set_num_threads(teamSize);
+#endif
+      for (int i = next++; i < n; i = next++) {
+        if (!failed) {
+          try {
+            func(i);
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+            failed = true;
+          }
+        }
+        if (++done == n) pool->Notify();
+      }
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_OMP
+      omp_set_num_threads(oldThreads);
+#endif
+    }
+  };
+
+  std::mutex mutex_;
+  // Wakes the workers when tasks are queued.
+  std::condition_variable cv_;
+  // Wakes the callers of ParallelFor when a batch finishes.
+  std::condition_variable waiting_;
+  std::deque<std::function<void()>> queue_;
+  std::vector<std::thread> workers_;
+
+  ThreadPool() {
+    const int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < nThreads; ++i) {
+      workers_.emplace_back([this]() {
+        for (;;) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return !queue_.empty(); });
+            task = std::move(queue_.front());
+            queue_.pop_front();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  // Taking the lock orders this after the waiter's check of its batch, so the
+  // wake-up cannot be lost.
+  void Notify() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_.notify_all();
+  }
+};
+
+/**
+ * Calls func(i) for each i in [0, n) concurrently. On the TBB backend this
+ * runs in the caller's task arena, within its concurrency limit, and on the
+ * other host backends on the ThreadPool. On the CUDA backend the calls run in
+ * order instead, since each one already fills the device and VecDH syncs its
+ * host and device copies lazily.
+ */
+template <typename Func>
+void ParallelFor(int n, Func func) {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+  for (int i = 0; i < n; ++i) func(i);
+#elif THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_TBB
+  // Isolation keeps this thread from picking up unrelated tasks while it
+  // waits, which may take locks it holds.
+  if (n > 0) {
+    tbb::this_task_arena::isolate([n, &func]() {
+      tbb::parallel_for(0, n, func);
+    });
+  }
+#else
+  ThreadPool::Get().ParallelFor(n, func);
+#endif
+}
+
+/**
+ * While in scope, the Thrust algorithms launched by this thread run serially
+ * if small is true. Under the OpenMP backend, spinning up a thread team costs
+ * more than the kernels of a small Boolean, so when many of those run
+ * concurrently, each is better off on a single core, like the CPP backend.
+ * Large inputs keep their share of the team. Other backends are unaffected.
+ */
+class SerialScope {
+ public:
+  explicit SerialScope(bool small) {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_OMP
+    if (small) {
+      oldThreads_ = omp_get_max_threads();
+      omp_set_num_threads(1);
+    }
+#endif
+  }
+
+  ~SerialScope() {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_OMP
+    if (oldThreads_ > 0) omp_set_num_threads(oldThreads_);
+#endif
+  }
+
+  SerialScope(const SerialScope&) = delete;
+  SerialScope& operator=(const SerialScope&) = delete;
+
+ private:
+  int oldThreads_ = 0;
+};
+/** @} */
+}  // namespace manifold
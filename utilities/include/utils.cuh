@@ -106,12 +106,56 @@ __host__ __device__ T AtomicAdd(T& target, T add) {
 #ifdef __CUDA_ARCH__
   return atomicAdd(&target, add);
 #else
-  T out;
-#pragma omp atomic capture
-  {
-    out = target;
-    target += add;
+  // Compare-and-swap loop rather than an OpenMP pragma, so this works for
+  // floats and ints under every host backend (OMP, TBB, CPP). The counter is
+  // also a handoff between threads, as in the collider's bottom-up passes,
+  // where the second arrival reads what the first wrote, so it must acquire
+  // and release.
+  T old;
+  __atomic_load(&target, &old, __ATOMIC_ACQUIRE);
+  T desired;
+  do {
+    desired = old + add;
+  } while (!__atomic_compare_exchange(&target, &old, &desired, true,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return old;
+#endif
+}
+
+template <typename T>
+__host__ __device__ T AtomicMin(T& target, T value) {
+#ifdef __CUDA_ARCH__
+  return atomicMin(&target, value);
+#else
+  T old;
+  __atomic_load(&target, &old, __ATOMIC_RELAXED);
+  while (value < old &&
+         !__atomic_compare_exchange(&target, &old, &value, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
   }
+  return old;
+#endif
+}
+
+// Returns the old value, so the swap succeeded if it equals compare.
+template <typename T>
+__host__ __device__ T AtomicCAS(T& target, T compare, T value) {
+#ifdef __CUDA_ARCH__
+  return atomicCAS(&target, compare, value);
+#else
+  __atomic_compare_exchange(&target, &compare, &value, false, __ATOMIC_RELAXED,
+                            __ATOMIC_RELAXED);
+  return compare;
+#endif
+}
+
+template <typename T>
+__host__ __device__ T AtomicLoad(const T& target) {
+#ifdef __CUDA_ARCH__
+  return *const_cast<const volatile T*>(&target);
+#else
+  T out;
+  __atomic_load(&target, &out, __ATOMIC_RELAXED);
   return out;
 #endif
 }
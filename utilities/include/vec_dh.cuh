@@ -16,13 +16,22 @@
 #include <thrust/device_vector.h>
 #include <thrust/host_vector.h>
 
+#include "allocator.cuh"
+
 namespace manifold {
 
 /** @addtogroup Private
  *  @{
  */
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
 template <typename T>
 using VecH = thrust::host_vector<T>;
+template <typename T>
+using VecDevice = thrust::device_vector<T, PoolAllocator<T>>;
+#else
+template <typename T>
+using VecH = thrust::host_vector<T, PoolAllocator<T>>;
+#endif
 
 template <typename T>
 void Dump(const VecH<T>& vec) {
@@ -33,6 +42,7 @@ void Dump(const VecH<T>& vec) {
   std::cout << std::endl;
 }
 
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
 template <typename T>
 class VecDH {
  public:
@@ -69,10 +79,10 @@ class VecDH {
     thrust::swap(device_valid_, other.device_valid_);
   }
 
-  using IterD = typename thrust::device_vector<T>::iterator;
-  using IterH = typename thrust::host_vector<T>::iterator;
-  using IterDc = typename thrust::device_vector<T>::const_iterator;
-  using IterHc = typename thrust::host_vector<T>::const_iterator;
+  using IterD = typename VecDevice<T>::iterator;
+  using IterH = typename VecH<T>::iterator;
+  using IterDc = typename VecDevice<T>::const_iterator;
+  using IterHc = typename VecH<T>::const_iterator;
 
   IterH begin() {
     RefreshHost();
@@ -170,8 +180,8 @@ class VecDH {
  private:
   mutable bool host_valid_ = true;
   mutable bool device_valid_ = true;
-  mutable thrust::host_vector<T> host_;
-  mutable thrust::device_vector<T> device_;
+  mutable VecH<T> host_;
+  mutable VecDevice<T> device_;
 
   void RefreshHost() const {
     if (!host_valid_) {
@@ -187,6 +197,72 @@ class VecDH {
     }
   }
 };
+#else
+/*
+ * On the CPU backends (OMP, CPP) the "device" is host memory, so host and
+ * device views share a single buffer and there is nothing to synchronize. The
+ * device iterators are still device_ptrs so that Thrust dispatches algorithms
+ * to the parallel device system.
+ */
+template <typename T>
+class VecDH {
+ public:
+  VecDH() {}
+
+  VecDH(int size, T val = T()) { data_.resize(size, val); }
+
+  VecDH(const std::vector<T>& vec) { data_ = vec; }
+
+  int size() const { return data_.size(); }
+
+  void resize(int newSize, T val = T()) {
+    bool shrink = size() > 2 * newSize;
+    data_.resize(newSize, val);
+    if (shrink) data_.shrink_to_fit();
+  }
+
+  void swap(VecDH<T>& other) { data_.swap(other.data_); }
+
+  using IterD = thrust::device_ptr<T>;
+  using IterH = typename VecH<T>::iterator;
+  using IterDc = thrust::device_ptr<const T>;
+  using IterHc = typename VecH<T>::const_iterator;
+
+  IterH begin() { return data_.begin(); }
+  IterH end() { return data_.end(); }
+
+  IterHc cbegin() const { return data_.cbegin(); }
+  IterHc cend() const { return data_.cend(); }
+
+  IterHc begin() const { return cbegin(); }
+  IterHc end() const { return cend(); }
+
+  IterD beginD() { return thrust::device_pointer_cast(data_.data()); }
+  IterD endD() { return beginD() + size(); }
+
+  IterDc cbeginD() const { return thrust::device_pointer_cast(data_.data()); }
+  IterDc cendD() const { return cbeginD() + size(); }
+
+  IterDc beginD() const { return cbeginD(); }
+  IterDc endD() const { return cendD(); }
+
+  T* ptrD() { return size() == 0 ? nullptr : data_.data(); }
+  const T* cptrD() const { return size() == 0 ? nullptr : data_.data(); }
+  const T* ptrD() const { return cptrD(); }
+
+  T* ptrH() { return ptrD(); }
+  const T* cptrH() const { return cptrD(); }
+  const T* ptrH() const { return cptrD(); }
+
+  const VecH<T>& H() const { return data_; }
+  VecH<T>& H() { return data_; }
+
+  void Dump() const { manifold::Dump(H()); }
+
+ private:
+  VecH<T> data_;
+};
+#endif
 
 template <typename T>
 class VecD {